@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2022-Present, Chen Yuan <yuan.chen@whu.edu.cn>
+ *
+ * All rights reserved. No warranty, explicit or implicit, provided.
+ */
+
+#ifndef INDEXRESEARCH_CHECKPOINT_H
+#define INDEXRESEARCH_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "constant.h"
+
+namespace FeatureBTree {
+
+/* header of a snapshot file (FBTree::save), followed by blocks of kv pairs in key
+ * order, each block holds block_size_ records (key bytes, value bytes) except the
+ * last one, and is followed by the checksum of its records; a delta file of an
+ * incremental checkpoint has the same header (block_size_ is 0, count_ is the
+ * number of ranges), followed by ranges, see DeltaRange */
+struct SnapshotHeader {
+  uint64_t magic_;
+  uint32_t key_size_;
+  uint32_t value_size_;
+  uint64_t block_size_;
+  uint64_t count_;    // the number of kv pairs
+  uint64_t checksum_; // of the fields above
+};
+
+static constexpr uint64_t kSnapshotMagic = 0x3153'4545'5254'4246ul; // "FBTREES1"
+static constexpr uint64_t kDeltaMagic = 0x3144'4545'5254'4246ul;    // "FBTREED1"
+
+inline uint64_t checksum(const void* data, size_t size) {
+  return util::hash((char*) data, size);
+}
+
+inline std::string numbered_file(const std::string& path, uint64_t seq) {
+  return path + "." + std::to_string(seq);
+}
+
+// sequence numbers of the existing files <path>.<seq>, ascending
+inline std::vector<uint64_t> numbered_files(const std::string& path) {
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+  std::string prefix = (slash == std::string::npos ? path : path.substr(slash + 1)) + ".";
+  std::vector<uint64_t> seqs;
+  DIR* handle = opendir(dir.c_str());
+  if(handle == nullptr) return seqs;
+  while(dirent* entry = readdir(handle)) {
+    std::string name = entry->d_name;
+    if(name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0) continue;
+    std::string seq = name.substr(prefix.size());
+    if(std::all_of(seq.begin(), seq.end(), ::isdigit)) seqs.push_back(std::stoull(seq));
+  }
+  closedir(handle);
+  std::sort(seqs.begin(), seqs.end());
+  return seqs;
+}
+
+template<typename K, typename V>
+class SnapshotReader { // sequential reader of a snapshot file
+  static constexpr size_t kRecord = sizeof(K) + sizeof(V);
+
+  int fd_;
+  SnapshotHeader header_;
+  std::vector<char> block_;
+  uint64_t read_;  // records read
+  size_t pos_;     // offset of the next record in block_
+  bool ok_;
+
+ public:
+  SnapshotReader() : fd_(-1), read_(0), pos_(0), ok_(false) {}
+
+  ~SnapshotReader() { if(fd_ >= 0) close(fd_); }
+
+  // open the snapshot at path and verify its header, false on error
+  bool open(const char* path) {
+    fd_ = ::open(path, O_RDONLY);
+    ok_ = fd_ >= 0 && read(fd_, &header_, sizeof(SnapshotHeader)) == sizeof(SnapshotHeader)
+          && header_.checksum_ == checksum(&header_, offsetof(SnapshotHeader, checksum_))
+          && header_.magic_ == kSnapshotMagic && header_.key_size_ == sizeof(K)
+          && header_.value_size_ == sizeof(V) && header_.block_size_ > 0;
+    return ok_;
+  }
+
+  // the next record in key order, false at the end or on error (see ok)
+  bool next(K& key, V& value) {
+    if(!ok_ || read_ == header_.count_) return false;
+    if(pos_ == block_.size()) { // read and verify the next block
+      size_t n = std::min<uint64_t>(header_.block_size_, header_.count_ - read_);
+      block_.resize(n * kRecord + sizeof(uint64_t));
+      uint64_t sum = 0;
+      if(read(fd_, block_.data(), block_.size()) == block_.size())
+        memcpy(&sum, block_.data() + n * kRecord, sizeof(uint64_t));
+      block_.resize(n * kRecord), pos_ = 0;
+      if(sum != checksum(block_.data(), block_.size())) return ok_ = false;
+    }
+    memcpy(&key, block_.data() + pos_, sizeof(K));
+    memcpy(&value, block_.data() + pos_ + sizeof(K), sizeof(V));
+    pos_ += kRecord, read_ += 1;
+    return true;
+  }
+
+  bool ok() { return ok_; }
+};
+
+template<typename K, typename V>
+class SnapshotWriter { // sequential writer of a snapshot file
+  static constexpr size_t kRecord = sizeof(K) + sizeof(V);
+
+  int fd_;
+  SnapshotHeader header_;
+  std::vector<char> block_;
+  bool ok_;
+
+  void write_block() {
+    uint64_t sum = checksum(block_.data(), block_.size());
+    block_.insert(block_.end(), (char*) &sum, (char*) &sum + sizeof(uint64_t));
+    if(write(fd_, block_.data(), block_.size()) != block_.size()) ok_ = false;
+    block_.clear();
+  }
+
+ public:
+  SnapshotWriter() : fd_(-1), header_{kSnapshotMagic, sizeof(K), sizeof(V), Config::kSnapshotBlock, 0, 0},
+                     ok_(false) {}
+
+  ~SnapshotWriter() { if(fd_ >= 0) close(fd_); }
+
+  bool open(const char* path) {
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok_ = fd_ >= 0 && lseek(fd_, sizeof(SnapshotHeader), SEEK_SET) == sizeof(SnapshotHeader);
+    return ok_;
+  }
+
+  // records are appended in key order
+  void append(const K& key, const V& value) {
+    block_.insert(block_.end(), (char*) &key, (char*) &key + sizeof(K));
+    block_.insert(block_.end(), (char*) &value, (char*) &value + sizeof(V));
+    header_.count_ += 1;
+    if(block_.size() == Config::kSnapshotBlock * kRecord) write_block();
+  }
+
+  // write the last block and the header, then sync, false on io error
+  bool finish() {
+    if(!block_.empty()) write_block();
+    header_.checksum_ = checksum(&header_, offsetof(SnapshotHeader, checksum_));
+    if(!ok_ || pwrite(fd_, &header_, sizeof(SnapshotHeader), 0) != sizeof(SnapshotHeader)) return false;
+    return fsync(fd_) == 0;
+  }
+};
+
+/* a key range (low, high] of a delta file and all kv pairs in it, which replace
+ * the kv pairs of the range in the base snapshot and the earlier deltas; the
+ * leftmost range has no low bound and the rightmost range has no high bound */
+template<typename K, typename V>
+struct DeltaRange {
+  bool has_low_;
+  bool has_high_;
+  K low_;
+  K high_;
+  std::vector<std::pair<K, V>> kvs_; // sorted by key
+
+  bool covers(const K& key) const {
+    return (!has_low_ || low_ < key) && (!has_high_ || !(high_ < key));
+  }
+
+  // on disk, a range header is followed by its records
+  struct Header {
+    uint64_t checksum_; // of the rest of the header and the records
+    uint32_t bounds_;   // 0x1: has low, 0x2: has high
+    uint32_t count_;
+    K low_;
+    K high_;
+  };
+};
+
+template<typename K, typename V>
+class DeltaWriter { // writer of a delta file
+  typedef DeltaRange<K, V> Range;
+  typedef typename Range::Header Header;
+
+  int fd_;
+  SnapshotHeader header_;
+  std::vector<char> buffer_;
+  bool ok_;
+
+ public:
+  DeltaWriter() : fd_(-1), header_{kDeltaMagic, sizeof(K), sizeof(V), 0, 0, 0}, ok_(false) {}
+
+  ~DeltaWriter() { if(fd_ >= 0) close(fd_); }
+
+  bool open(const char* path) {
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok_ = fd_ >= 0 && lseek(fd_, sizeof(SnapshotHeader), SEEK_SET) == sizeof(SnapshotHeader);
+    return ok_;
+  }
+
+  // ranges are appended in key order, kvs are sorted by key
+  template<typename KV>
+  void append(bool has_low, const K& low, bool has_high, const K& high, const std::vector<KV*>& kvs) {
+    Header header{};
+    header.bounds_ = (has_low ? 0x1 : 0) | (has_high ? 0x2 : 0);
+    header.count_ = kvs.size(), header.low_ = low, header.high_ = high;
+    buffer_.assign((char*) &header, (char*) &header + sizeof(Header));
+    for(KV* kv : kvs) {
+      buffer_.insert(buffer_.end(), (char*) &kv->key, (char*) &kv->key + sizeof(K));
+      buffer_.insert(buffer_.end(), (char*) &kv->value, (char*) &kv->value + sizeof(V));
+    }
+    header.checksum_ = checksum(buffer_.data() + sizeof(uint64_t), buffer_.size() - sizeof(uint64_t));
+    memcpy(buffer_.data(), &header.checksum_, sizeof(uint64_t));
+    if(write(fd_, buffer_.data(), buffer_.size()) != buffer_.size()) ok_ = false;
+    header_.count_ += 1;
+  }
+
+  bool finish() {
+    header_.checksum_ = checksum(&header_, offsetof(SnapshotHeader, checksum_));
+    if(!ok_ || pwrite(fd_, &header_, sizeof(SnapshotHeader), 0) != sizeof(SnapshotHeader)) return false;
+    return fsync(fd_) == 0;
+  }
+};
+
+/* apply(range) to the ranges of the delta file at path in order, false if the
+ * file can't be read or is corrupted (it is renamed in place once complete) */
+template<typename K, typename V, typename F>
+bool read_delta(const char* path, F&& apply) {
+  typedef DeltaRange<K, V> Range;
+  typedef typename Range::Header Header;
+  constexpr size_t kRecord = sizeof(K) + sizeof(V);
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return false;
+  SnapshotHeader header;
+  bool ok = read(fd, &header, sizeof(SnapshotHeader)) == sizeof(SnapshotHeader)
+            && header.checksum_ == checksum(&header, offsetof(SnapshotHeader, checksum_))
+            && header.magic_ == kDeltaMagic && header.key_size_ == sizeof(K)
+            && header.value_size_ == sizeof(V);
+  std::vector<char> buffer;
+  Range range;
+  for(uint64_t rid = 0; ok && rid < header.count_; rid++) {
+    Header rheader;
+    buffer.resize(sizeof(Header));
+    ok = read(fd, buffer.data(), sizeof(Header)) == sizeof(Header);
+    memcpy(&rheader, buffer.data(), sizeof(Header));
+    buffer.resize(sizeof(Header) + rheader.count_ * kRecord);
+    size_t size = buffer.size() - sizeof(Header);
+    ok = ok && read(fd, buffer.data() + sizeof(Header), size) == size
+         && rheader.checksum_ == checksum(buffer.data() + sizeof(uint64_t), buffer.size() - sizeof(uint64_t));
+    if(!ok) break;
+
+    range.has_low_ = rheader.bounds_ & 0x1, range.has_high_ = rheader.bounds_ & 0x2;
+    range.low_ = rheader.low_, range.high_ = rheader.high_;
+    range.kvs_.resize(rheader.count_);
+    for(uint32_t i = 0; i < rheader.count_; i++) {
+      char* record = buffer.data() + sizeof(Header) + i * kRecord;
+      memcpy(&range.kvs_[i].first, record, sizeof(K));
+      memcpy(&range.kvs_[i].second, record + sizeof(K), sizeof(V));
+    }
+    apply(range);
+  }
+  close(fd);
+  return ok;
+}
+
+/* fold the delta files <path>.<seq> into the base snapshot at path: the deltas
+ * (proportional to churn) are merged in memory, then the base is streamed once to
+ * a new base, skipping its kv pairs in ranges of the deltas; the new base is renamed
+ * in place before the deltas are removed, and reapplying a delta to the new base
+ * after a crash changes nothing, since the last range covering a key wins */
+template<typename K, typename V>
+bool fold_deltas(const char* path) {
+  typedef DeltaRange<K, V> Range;
+  std::vector<uint64_t> seqs = numbered_files(path);
+  if(seqs.empty()) return true;
+
+  std::map<K, V> kvs;        // kv pairs of the ranges
+  std::vector<Range> ranges; // bounds only
+  for(uint64_t seq : seqs) {
+    bool ok = read_delta<K, V>(numbered_file(path, seq).c_str(), [&](Range& range) {
+      auto begin = range.has_low_ ? kvs.upper_bound(range.low_) : kvs.begin();
+      auto end = range.has_high_ ? kvs.upper_bound(range.high_) : kvs.end();
+      kvs.erase(begin, end);
+      kvs.insert(range.kvs_.begin(), range.kvs_.end());
+      range.kvs_.clear();
+      ranges.push_back(range);
+    });
+    if(!ok) return false;
+  }
+  // sort ranges by low bounds, so the ranges covering a key are found while streaming
+  std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) {
+    return a.has_low_ < b.has_low_ || (a.has_low_ && b.has_low_ && a.low_ < b.low_);
+  });
+
+  std::string temp = std::string(path) + ".fold";
+  SnapshotReader<K, V> reader;
+  SnapshotWriter<K, V> writer;
+  if(!reader.open(path) || !writer.open(temp.c_str())) return false;
+  K key;
+  V value;
+  auto it = kvs.begin();
+  size_t rid = 0;          // ranges before rid have no greater high bound than key
+  std::vector<Range*> open; // ranges whose low bounds are less than key
+  while(reader.next(key, value)) {
+    for(; it != kvs.end() && it->first < key; ++it) writer.append(it->first, it->second);
+    for(; rid < ranges.size() && (!ranges[rid].has_low_ || ranges[rid].low_ < key); rid++)
+      open.push_back(&ranges[rid]);
+    open.erase(std::remove_if(open.begin(), open.end(), [&](Range* range) {
+      return range->has_high_ && range->high_ < key; // keys are ascending
+    }), open.end());
+    if(open.empty()) writer.append(key, value); // not covered by any delta
+  }
+  for(; it != kvs.end(); ++it) writer.append(it->first, it->second);
+  if(!reader.ok() || !writer.finish() || rename(temp.c_str(), path) != 0) return false;
+  for(uint64_t seq : seqs) unlink(numbered_file(path, seq).c_str());
+  return true;
+}
+
+}
+
+#endif //INDEXRESEARCH_CHECKPOINT_H
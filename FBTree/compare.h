@@ -7,9 +7,15 @@
 #ifndef INDEXRESEARCH_COMPARE_H
 #define INDEXRESEARCH_COMPARE_H
 
+#include <cstdint>
+#include <cstring>
 #include "config.h"
 #include "simd.h"
 
+#if defined(AVX512BW_ENABLE) || defined(AVX2_ENABLE) || defined(SSE2_ENABLE)
+#include <immintrin.h>
+#endif
+
 namespace FeatureBTree {
 
 using util::cmpeq_int8_simd128;
@@ -116,6 +122,131 @@ inline uint64_t compare_less_64(void* p1, void* p2) {
   }
 }
 
+/* kernels for string keys (equality, mismatch position, three-way compare
+ * and leaf tag), the widest instruction set enabled by cmake is selected at
+ * compile time, same as feature comparison; avx512bw handles the tail with a
+ * masked load, avx2/sse2 fall back to 8-byte words then to single bytes */
+
+/* the index of the first different byte of a and b, len if equal */
+inline int key_mismatch(const char* a, const char* b, int len) {
+  int i = 0;
+#if defined(AVX512BW_ENABLE)
+  for(; i + 64 <= len; i += 64) {
+    __m512i va = _mm512_loadu_si512(a + i);
+    __m512i vb = _mm512_loadu_si512(b + i);
+    uint64_t ne = _mm512_cmpneq_epi8_mask(va, vb);
+    if(ne) return i + __builtin_ctzll(ne);
+  }
+  if(i < len) {
+    __mmask64 mask = (0x01ul << (len - i)) - 1; // len - i < 64
+    __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+    __m512i vb = _mm512_maskz_loadu_epi8(mask, b + i);
+    uint64_t ne = _mm512_cmpneq_epi8_mask(va, vb);
+    if(ne) return i + __builtin_ctzll(ne);
+  }
+  return len;
+#else
+#if defined(AVX2_ENABLE)
+  for(; i + 32 <= len; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+    uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+    if(eq != 0xFFFFFFFFu) return i + __builtin_ctz(~eq);
+  }
+#endif
+#if defined(SSE2_ENABLE)
+  for(; i + 16 <= len; i += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+    uint32_t eq = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+    if(eq != 0xFFFFu) return i + __builtin_ctz(~eq);
+  }
+#endif
+  for(; i + 8 <= len; i += 8) {
+    uint64_t wa, wb;
+    memcpy(&wa, a + i, 8), memcpy(&wb, b + i, 8);
+    if(wa != wb) return i + __builtin_ctzll(wa ^ wb) / 8; // little endian
+  }
+  for(; i < len; i++) {
+    if(a[i] != b[i]) return i;
+  }
+  return len;
+#endif
+}
+
+/* length of the common prefix of a and b */
+inline int key_common_prefix(const char* a, int alen, const char* b, int blen) {
+  return key_mismatch(a, b, alen < blen ? alen : blen);
+}
+
+inline bool key_equal(const char* a, int alen, const char* b, int blen) {
+  return alen == blen && key_mismatch(a, b, alen) == alen;
+}
+
+/* three-way comparison, bytes are compared as unsigned char, like memcmp */
+inline int key_compare(const char* a, int alen, const char* b, int blen) {
+  int len = alen < blen ? alen : blen;
+  int pos = key_mismatch(a, b, len);
+  if(pos < len) return (int) (uint8_t) a[pos] - (int) (uint8_t) b[pos];
+  return alen - blen;
+}
+
+inline uint64_t tag_mix(uint64_t h) { // murmur3 finalizer
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdul;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ul;
+  h ^= h >> 33;
+  return h;
+}
+
+/* 8-bit fingerprint of a string key stored in leaf tags, blocks are mixed in
+ * vector registers (xxh3-like multiply-accumulate), then folded to a word */
+inline char key_tag(const char* s, int len) {
+  constexpr uint64_t kPrime = 0x9e3779b97f4a7c15ul;
+  uint64_t h = len * kPrime;
+  int i = 0;
+#if defined(AVX512BW_ENABLE)
+  const __m512i secret = _mm512_set1_epi64(kPrime);
+  __m512i acc = _mm512_setzero_si512();
+  for(; i < len; i += 64) {
+    __mmask64 mask = len - i >= 64 ? ~0x00ul : (0x01ul << (len - i)) - 1;
+    __m512i data = _mm512_xor_si512(_mm512_maskz_loadu_epi8(mask, s + i), secret);
+    __m512i prod = _mm512_mul_epu32(data, _mm512_srli_epi64(data, 32));
+    acc = _mm512_add_epi64(acc, _mm512_add_epi64(prod, data));
+  }
+  uint64_t lane[8];
+  _mm512_storeu_si512(lane, acc);
+  for(int l = 0; l < 8; l++) h = (h ^ lane[l]) * kPrime;
+#else
+#if defined(AVX2_ENABLE)
+  if(len >= 32) {
+    const __m256i secret = _mm256_set1_epi64x(kPrime);
+    __m256i acc = _mm256_setzero_si256();
+    for(; i + 32 <= len; i += 32) {
+      __m256i data = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (s + i)), secret);
+      __m256i prod = _mm256_mul_epu32(data, _mm256_srli_epi64(data, 32));
+      acc = _mm256_add_epi64(acc, _mm256_add_epi64(prod, data));
+    }
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i*) lane, acc);
+    for(int l = 0; l < 4; l++) h = (h ^ lane[l]) * kPrime;
+  }
+#endif
+  for(; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, s + i, 8);
+    h = (h ^ w) * kPrime;
+  }
+  if(i < len) {
+    uint64_t w = 0;
+    memcpy(&w, s + i, len - i);
+    h = (h ^ w) * kPrime;
+  }
+#endif
+  return (char) tag_mix(h);
+}
+
 }
 
 #endif //INDEXRESEARCH_COMPARE_H
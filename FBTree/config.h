@@ -8,6 +8,7 @@
 #define INDEXRESEARCH_CONFIG_H
 
 #include <string>
+#include <algorithm>
 
 namespace FeatureBTree {
 
@@ -25,6 +26,8 @@ namespace FeatureBTree {
 
 enum CompareMode { SIMD512, SIMD256, SIMD128 };
 
+enum LatchMode { BACKOFF, QUEUE };
+
 struct Config {
   /* manipulation mode of feature comparison and fingerprint comparison */
   static constexpr CompareMode kCmpMode = SIMD256;
@@ -49,12 +52,97 @@ struct Config {
    * kSpinInit at first to ensure there is heavy contention, increase
    * kSpinInc times to ensure a thread does not wait too long */
   static constexpr int kSpinInit = 3, kSpinInc = 2;
+  /* policy of exclusive latch, BACKOFF: spin with CAS, then yield/sleep;
+   * QUEUE: writers line up in a MCS queue (the tail is encoded in the node
+   * control word, see control.h) and only the queue head polls the latch,
+   * optimistic reads and versions are unchanged; -DFB_QUEUE_LATCH to enable */
+#ifdef FB_QUEUE_LATCH
+  static constexpr LatchMode kLatchMode = QUEUE;
+#else
+  static constexpr LatchMode kLatchMode = BACKOFF;
+#endif
+  /* skew-aware split, if the inserted key falls at either end of a full node,
+   * or right after/before the latest inserted key of a full leaf node, cut at
+   * the inserted key (at least 1/kSkewRatio of the keys on each side) instead
+   * of splitting evenly, which raises node fill factor under (partially)
+   * sequential insertion */
+  static constexpr bool kSkewSplit = true;
+  static constexpr int kSkewRatio = 8;
+  /* write-combining delta buffer of hot leaf nodes (basic type keys only), a
+   * leaf node turns hot after its latch has been contended 7 times, then new
+   * keys are appended to its delta buffer without latching the leaf node or
+   * updating its version, and the next writer applies them in one latch section;
+   * each maintenance pass halves the heat, and a leaf node no longer hot drops
+   * its delta buffer, so only recently contended leaf nodes keep buffering */
+  static constexpr bool kDeltaOpt = false;
+  /* the number of kv pairs in a delta buffer, valid if kDeltaOpt(true) */
+  static constexpr int kDeltaSize = 8;
+  /* the number of kv pairs staged by an appender (append mode) before
+   * linking them into the tree, see FBTree::Appender */
+  static constexpr int kAppendSize = 256;
+  /* the number of kv pairs per checksummed block of a snapshot file, see FBTree::save */
+  static constexpr int kSnapshotBlock = 4096;
+  /* track the checkpoint generation modifying each leaf node (8 bytes per leaf
+   * node), so an incremental checkpoint only writes leaf nodes modified since the
+   * last checkpoint, see FBTree::checkpoint_incremental; otherwise it writes all */
+  static constexpr bool kDirtyOpt = false;
+  /* page kv pairs of cold leaf nodes out to a file (basic type keys, trivially
+   * copyable values), see FBTree::open_pager; leaf nodes and inner nodes stay
+   * resident, a clock sweep over the leaf chain pages out leaf nodes not accessed
+   * since the last sweep, and an access to a paged out leaf node reads it back */
+  static constexpr bool kPagingOpt = false;
+  /* the number of leaf nodes holding their kv pairs in memory, kept by
+   * FBTree::maintain, valid if kPagingOpt(true) */
+  static constexpr int kResidentLeaves = 1 << 16;
+  /* snapshot reads (basic type keys), see FBTree::Snapshot: writes take the leaf
+   * latch and a timestamp from a shared clock, and keep the kvs they replace
+   * while some snapshot is older; not combined with kDeltaOpt, whose appends
+   * bypass the latch */
+  static constexpr bool kMvccOpt = false;
+  /* size classes of the root leaf node (kLeafSize >> class slots, at least 16),
+   * a tree holding a few keys starts with a small root leaf node, which is
+   * replaced by the next larger class once full (the largest class splits as
+   * usual), and by a smaller class once a quarter full after removal */
+  static constexpr bool kLeafClassOpt = false;
+  /* size classes of the root inner node of string keys (kInnerSize >> class
+   * anchors, at least 16, the smallest class without embedded prefix), a new
+   * root holding one anchor is created of the smallest class, and resized like
+   * the root leaf node, which keeps the top of the tree compact in cache */
+  static constexpr bool kInnerClassOpt = false;
+  /* hash directory from key prefixes to leaf nodes for point lookups (basic
+   * type keys only), see LeafDirectory, lookups hitting the directory skip
+   * the traversal of inner nodes */
+  static constexpr bool kLeafDirectory = false;
+  /* the directory has 2^kDirectoryBits entries, valid if kLeafDirectory(true) */
+  static constexpr int kDirectoryBits = 16;
+  /* integer keys sharing key >> kDirectoryShift share one directory entry */
+  static constexpr int kDirectoryShift = 6;
+  /* learned root model over the inner nodes kModelLevels levels below the root
+   * (integer keys only), see RootModel, lookups start from the predicted inner
+   * node instead of the root; it is rebuilt once inner nodes are deleted, or
+   * once inner nodes have been split 1/kModelRebuild as many times as it has nodes */
+  static constexpr bool kRootModel = false;
+  static constexpr int kModelLevels = 2;
+  /* the maximum error of predicted positions, valid if kRootModel(true) */
+  static constexpr int kModelError = 8;
+  static constexpr int kModelRebuild = 8;
   /* store anchors in contiguous memory blocks, not scattered */
   static constexpr bool kExtentOpt = false;
   /* the initial extent size, valid if kExtentOpt(true) */
   static constexpr int kExtentSize = 2048;
 };
 
+/* the number of keys left in the left node when splitting a full node of size
+ * keys, pos is the ordinal of the inserted key among the keys (0 ... size),
+ * clustered: recent inserts cluster around pos, e.g., an ascending stream */
+inline int split_point(int pos, int size, bool clustered) {
+  if(Config::kSkewSplit && (clustered || pos <= 0 || pos >= size - 1)) {
+    int low = size / Config::kSkewRatio; // at least low keys on each side
+    return std::min(std::max(pos, low), size - low);
+  }
+  return size / 2;
+}
+
 inline std::string compare_mode() {
   switch(Config::kCmpMode) {
     case SIMD512:
@@ -86,6 +174,21 @@ static_assert(Config::kAlignSize == 32 || Config::kAlignSize == 64);
 
 static_assert(Config::kExtentSize % 2048 == 0);
 
+static_assert(Config::kSkewRatio >= 2 && Config::kSkewRatio <= Config::kInnerSize / 2
+              && Config::kSkewRatio <= Config::kLeafSize / 2);
+
+static_assert(Config::kDeltaSize > 0 && Config::kDeltaSize < Config::kLeafSize);
+
+static_assert(Config::kDirectoryBits > 0 && Config::kDirectoryBits < 32);
+
+static_assert(Config::kSnapshotBlock > 0);
+
+static_assert(Config::kResidentLeaves > 0);
+
+static_assert(!(Config::kMvccOpt && Config::kDeltaOpt));
+
+static_assert(Config::kModelLevels > 0 && Config::kModelError > 0 && Config::kModelRebuild > 0);
+
 #ifndef AVX512BW_ENABLE
 static_assert(Config::kCmpMode != SIMD512);
 #endif
@@ -8,17 +8,168 @@
 #define INDEXRESEARCH_CONSTANT_H
 
 #include <iostream>
+#include <iomanip>
 #include <cstdint>
+#include <cstring>
+#include <array>
 #include <limits>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <type_traits>
 #include "config.h"
 #include "type.h"
 #include "common.h"
+#include "hash.h"
+#include "debug.h"
 
 namespace FeatureBTree {
 
 using util::String;
 using util::byte_swap;
 
+/* fixed-width binary key, bytes are compared lexicographically as unsigned
+ * chars, it's the target of KeyEncoder::fixed<N>(), so short
+ * composite keys can be indexed by the fixed-width node without going through
+ * the String code path */
+template<int N>
+struct FixedKey {
+  static_assert(N > 0 && N <= 16, "fixed key is limited to 16 bytes");
+
+  uint8_t data[N];
+
+  FixedKey() = default;
+
+  FixedKey(const std::array<uint8_t, N>& key) { memcpy(data, key.data(), N); }
+
+  std::array<uint8_t, N> array() const {
+    std::array<uint8_t, N> key;
+    memcpy(key.data(), data, N);
+    return key;
+  }
+
+  // 8/16-byte keys (e.g., uuid) are compared as one/two big-endian 64-bit words
+  int compare(const FixedKey& rhs) const {
+    if constexpr(N % 8 == 0) {
+      for(int i = 0; i < N; i += 8) {
+        uint64_t l, r;
+        memcpy(&l, data + i, 8), memcpy(&r, rhs.data + i, 8);
+        if(l != r) return byte_swap(l) < byte_swap(r) ? -1 : 1;
+      }
+      return 0;
+    } else {
+      return memcmp(data, rhs.data, N);
+    }
+  }
+
+  bool equal(const FixedKey& rhs) const {
+    if constexpr(N % 8 == 0) {
+      for(int i = 0; i < N; i += 8) {
+        uint64_t l, r;
+        memcpy(&l, data + i, 8), memcpy(&r, rhs.data + i, 8);
+        if(l != r) return false;
+      }
+      return true;
+    } else {
+      return memcmp(data, rhs.data, N) == 0;
+    }
+  }
+
+  bool operator==(const FixedKey& rhs) const { return equal(rhs); }
+  bool operator!=(const FixedKey& rhs) const { return !equal(rhs); }
+  bool operator<(const FixedKey& rhs) const { return compare(rhs) < 0; }
+  bool operator>(const FixedKey& rhs) const { return compare(rhs) > 0; }
+  bool operator<=(const FixedKey& rhs) const { return compare(rhs) <= 0; }
+  bool operator>=(const FixedKey& rhs) const { return compare(rhs) >= 0; }
+};
+
+typedef unsigned __int128 uint128_t;
+
+inline uint128_t byte_swap(uint128_t key) {
+  uint64_t lo = byte_swap((uint64_t) key), hi = byte_swap((uint64_t) (key >> 64));
+  return ((uint128_t) lo << 64) | hi;
+}
+
+inline auto hash(uint128_t key) {
+  return util::hash((char*) &key, sizeof(uint128_t));
+}
+
+inline std::ostream& operator<<(std::ostream& os, uint128_t key) {
+  std::ios_base::fmtflags flags = os.flags();
+  os << std::hex << std::setfill('0') << std::setw(16) << (uint64_t) (key >> 64)
+     << std::setw(16) << (uint64_t) key;
+  os.flags(flags);
+  return os;
+}
+
+/* floating point keys, -0.0 and +0.0 are equal keys, so they must share
+ * the same encoding and hash tag */
+inline float byte_swap(float key) {
+  uint32_t u;
+  memcpy(&u, &key, sizeof(float));
+  u = byte_swap(u);
+  memcpy(&key, &u, sizeof(float));
+  return key;
+}
+
+inline double byte_swap(double key) {
+  uint64_t u;
+  memcpy(&u, &key, sizeof(double));
+  u = byte_swap(u);
+  memcpy(&key, &u, sizeof(double));
+  return key;
+}
+
+inline auto hash(float key) {
+  if(key == 0) key = 0; // fold -0.0
+  return util::hash((char*) &key, sizeof(float));
+}
+
+inline auto hash(double key) {
+  if(key == 0) key = 0; // fold -0.0
+  return util::hash((char*) &key, sizeof(double));
+}
+
+template<int N>
+inline auto hash(const FixedKey<N>& key) {
+  return util::hash((char*) key.data, N);
+}
+
+template<int N>
+inline std::ostream& operator<<(std::ostream& os, const FixedKey<N>& key) {
+  std::ios_base::fmtflags flags = os.flags();
+  os << std::hex << std::setfill('0');
+  for(int i = 0; i < N; i++)
+    os << std::setw(2) << (int) key.data[i];
+  os.flags(flags);
+  return os;
+}
+
+/* ieee-754 floating point numbers are sign-magnitude, flipping the sign bit of
+ * non-negative numbers and all the bits of negative numbers makes their bit
+ * patterns ordered as unsigned integers (-inf < ... < -0.0 < +0.0 < ... < +inf);
+ * -0.0 is folded into +0.0, NaN is unordered and can't be used as a key */
+template<typename F, typename U>
+inline U float_convert(F key) {
+  static_assert(sizeof(F) == sizeof(U));
+  constexpr U kSign = U(1) << (sizeof(U) * 8 - 1);
+  DEBUG_COND_ERROR(key != key, "NaN can't be used as a key");
+  if(key == 0) key = 0; // fold -0.0
+  U u;
+  memcpy(&u, &key, sizeof(F));
+  return (u & kSign) ? ~u : (u | kSign);
+}
+
+template<typename F, typename U>
+inline F float_reconvert(U u) {
+  static_assert(sizeof(F) == sizeof(U));
+  constexpr U kSign = U(1) << (sizeof(U) * 8 - 1);
+  u = (u & kSign) ? (u & ~kSign) : ~u;
+  F key;
+  memcpy(&key, &u, sizeof(F));
+  return key;
+}
+
 template<typename T>
 struct Constant;
 
@@ -33,6 +184,21 @@ struct Constant<String> {
   static void node_parameter();
 };
 
+template<>
+struct Constant<uint128_t> {
+  static constexpr int kInnerSize = Config::kInnerSize;
+  static constexpr int kLeafSize = Config::kLeafSize;
+  static constexpr int kInnerMergeSize = Config::kInnerMergeSize;
+  static constexpr int kLeafMergeSize = Config::kLeafMergeSize;
+  static constexpr int kFeatureSize = sizeof(uint128_t);
+
+  static void node_parameter();
+
+  static inline uint128_t convert(uint128_t key) { return key; }
+
+  static inline uint128_t reconvert(uint128_t key) { return key; }
+};
+
 template<>
 struct Constant<uint64_t> {
   static constexpr int kInnerSize = Config::kInnerSize;
@@ -44,6 +210,8 @@ struct Constant<uint64_t> {
   static void node_parameter();
 
   static inline uint64_t convert(uint64_t key) { return key; }
+
+  static inline uint64_t reconvert(uint64_t key) { return key; }
 };
 
 template<>
@@ -59,6 +227,8 @@ struct Constant<int64_t> {
   static inline int64_t convert(int64_t key) {
     return std::numeric_limits<int64_t>::max() + 1 + key;
   }
+
+  static inline int64_t reconvert(int64_t key) { return convert(key); }
 };
 
 template<>
@@ -72,6 +242,8 @@ struct Constant<uint32_t> {
   static void node_parameter();
 
   static inline uint32_t convert(uint32_t key) { return key; }
+
+  static inline uint32_t reconvert(uint32_t key) { return key; }
 };
 
 template<>
@@ -87,8 +259,27 @@ struct Constant<int32_t> {
   static inline int32_t convert(int32_t key) {
     return std::numeric_limits<int32_t>::max() + 1 + key;
   }
+
+  static inline int32_t reconvert(int32_t key) { return convert(key); }
 };
 
+template<int N>
+struct Constant<FixedKey<N>> {
+  static constexpr int kInnerSize = Config::kInnerSize;
+  static constexpr int kLeafSize = Config::kLeafSize;
+  static constexpr int kInnerMergeSize = Config::kInnerMergeSize;
+  static constexpr int kLeafMergeSize = Config::kLeafMergeSize;
+  static constexpr int kFeatureSize = N;
+
+  static_assert(sizeof(FixedKey<N>) == N);
+
+  static void node_parameter();
+};
+
+// byte array keys (e.g., uuid) are fixed keys, see FBTree<std::array<uint8_t, N>, V>
+template<size_t N>
+struct Constant<std::array<uint8_t, N>> : Constant<FixedKey<N>> {};
+
 template<>
 struct Constant<float> {
   static constexpr int kInnerSize = Config::kInnerSize;
@@ -100,6 +291,19 @@ struct Constant<float> {
   static_assert(kFeatureSize == 4);
 
   static void node_parameter();
+
+  // keep the converted bits in float, only memory copy is applied on them
+  static inline float convert(float key) {
+    uint32_t u = float_convert<float, uint32_t>(key);
+    memcpy(&key, &u, sizeof(float));
+    return key;
+  }
+
+  static inline float reconvert(float key) {
+    uint32_t u;
+    memcpy(&u, &key, sizeof(float));
+    return float_reconvert<float, uint32_t>(u);
+  }
 };
 
 template<>
@@ -113,6 +317,19 @@ struct Constant<double> {
   static_assert(kFeatureSize == 8);
 
   static void node_parameter();
+
+  // keep the converted bits in double, only memory copy is applied on them
+  static inline double convert(double key) {
+    uint64_t u = float_convert<double, uint64_t>(key);
+    memcpy(&key, &u, sizeof(double));
+    return key;
+  }
+
+  static inline double reconvert(double key) {
+    uint64_t u;
+    memcpy(&u, &key, sizeof(double));
+    return float_reconvert<double, uint64_t>(u);
+  }
 };
 
 inline void Constant<String>::node_parameter() {
@@ -121,6 +338,12 @@ inline void Constant<String>::node_parameter() {
             << kLeafMergeSize << ", feature size:" << kFeatureSize << std::endl;
 }
 
+inline void Constant<uint128_t>::node_parameter() {
+  std::cout << "-- node parameter: compare mode:" << compare_mode() << ", inner node size:" << kInnerSize
+            << ", leaf node size:" << kLeafSize << ", inner merge size:" << kInnerMergeSize << ", leaf merge size:"
+            << kLeafMergeSize << ", feature size:" << kFeatureSize << std::endl;
+}
+
 inline void Constant<uint64_t>::node_parameter() {
   std::cout << "-- node parameter: compare mode:" << compare_mode() << ", inner node size:" << kInnerSize
             << ", leaf node size:" << kLeafSize << ", inner merge size:" << kInnerMergeSize << ", leaf merge size:"
@@ -145,6 +368,13 @@ inline void Constant<int32_t>::node_parameter() {
             << kLeafMergeSize << ", feature size:" << kFeatureSize << std::endl;
 }
 
+template<int N>
+inline void Constant<FixedKey<N>>::node_parameter() {
+  std::cout << "-- node parameter: compare mode:" << compare_mode() << ", inner node size:" << kInnerSize
+            << ", leaf node size:" << kLeafSize << ", inner merge size:" << kInnerMergeSize << ", leaf merge size:"
+            << kLeafMergeSize << ", feature size:" << kFeatureSize << std::endl;
+}
+
 inline void Constant<float>::node_parameter() {
   std::cout << "-- node parameter: compare mode:" << compare_mode() << ", inner node size:" << kInnerSize
             << ", leaf node size:" << kLeafSize << ", inner merge size:" << kInnerMergeSize << ", leaf merge size:"
@@ -180,7 +410,6 @@ inline void Constant<double>::node_parameter() {
  * compatibility, oh damn, hope everything works well. */
 template<typename K>
 inline K encode_convert(K key) {
-  // convert and byte_swap have restricted K cannot be double/float or other types
   key = Constant<K>::convert(key); // encoding converting
   key = byte_swap(key); // endian swap
 
@@ -200,10 +429,169 @@ inline K encode_reconvert(K key) {
   }
 
   key = byte_swap(key); // endian swap
-  key = Constant<K>::convert(key); // encoding converting
+  key = Constant<K>::reconvert(key); // encoding reconverting
+  return key;
+}
+
+/* fixed key is already in big-endian unsigned form, only the byte encoding
+ * converting of item 3) is needed */
+template<int N>
+inline FixedKey<N> encode_convert(FixedKey<N> key) {
+  for(int i = 0; i < N; i++) {
+    key.data[i] += 128;
+  }
+  return key;
+}
+
+template<int N>
+inline FixedKey<N> encode_reconvert(FixedKey<N> key) {
+  for(int i = 0; i < N; i++) {
+    key.data[i] += 128;
+  }
   return key;
 }
 
+/* order-preserving encoder for composite (multi-column) keys, the encoded bytes
+ * compare with memcmp in the same order as the tuple compares column by column:
+ * 1) unsigned integers are stored in big-endian; signed integers flip the sign
+ * bit first, same as item 1) above; \n
+ * 2) float/double are converted by float_convert, NaN throws std::invalid_argument; \n
+ * 3) strings are variable-length, 0x00 is escaped as 0x00 0xFF and each string
+ * is terminated by 0x00 0x01, so no encoded string is a prefix of another one,
+ * the terminator is less than any escaped or normal byte. \n
+ * the result can be used as String key, or as FixedKey<N> key if it is short
+ * enough (zero padding after a prefix-free encoding keeps the order) */
+class KeyEncoder {
+  std::string buf_;
+
+  template<typename U>
+  void append_big_endian(U u) {
+    for(int i = sizeof(U) - 1; i >= 0; i--)
+      buf_.push_back((char) (u >> (i * 8)));
+  }
+
+ public:
+  KeyEncoder() = default;
+
+  template<typename T>
+  KeyEncoder& append(T value) {
+    static_assert(std::is_arithmetic_v<T>, "unsupported column type");
+    if constexpr(std::is_floating_point_v<T>) {
+      if(value != value) throw std::invalid_argument("NaN column is unordered");
+      typedef std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t> U;
+      append_big_endian(float_convert<T, U>(value));
+    } else {
+      typedef std::make_unsigned_t<T> U;
+      U u = (U) value;
+      if constexpr(std::is_signed_v<T>)
+        u ^= U(1) << (sizeof(U) * 8 - 1);
+      append_big_endian(u);
+    }
+    return *this;
+  }
+
+  KeyEncoder& append(std::string_view str) {
+    for(char c : str) {
+      buf_.push_back(c);
+      if(c == 0) buf_.push_back((char) 0xFF);
+    }
+    buf_.push_back(0);
+    buf_.push_back(0x01);
+    return *this;
+  }
+
+  KeyEncoder& append(const char* str) {
+    return append(std::string_view(str));
+  }
+
+  KeyEncoder& append(const char* str, int len) {
+    return append(std::string_view(str, len));
+  }
+
+  KeyEncoder& append(const std::string& str) {
+    return append(std::string_view(str));
+  }
+
+  void clear() { buf_.clear(); }
+
+  const char* data() const { return buf_.data(); }
+
+  int size() const { return buf_.size(); }
+
+  const std::string& str() const { return buf_; }
+
+  // throw std::length_error if the encoded key is longer than N bytes
+  template<int N>
+  FixedKey<N> fixed() const {
+    if(buf_.size() > (size_t) N) throw std::length_error("encoded key is too long for fixed key");
+    FixedKey<N> key;
+    memset(key.data, 0, N);
+    memcpy(key.data, buf_.data(), buf_.size());
+    return key;
+  }
+};
+
+/* decodes the columns of a key produced by KeyEncoder, columns must be read
+ * in the same order and with the same types as they were appended, reading
+ * past the end or a malformed string column throws std::out_of_range */
+class KeyDecoder {
+  const uint8_t* data_;
+  int len_;
+  int pos_;
+
+  template<typename U>
+  U read_big_endian() {
+    if(pos_ + (int) sizeof(U) > len_) throw std::out_of_range("decode out of range");
+    U u = 0;
+    for(size_t i = 0; i < sizeof(U); i++)
+      u = (u << 8) | data_[pos_ + i];
+    pos_ += sizeof(U);
+    return u;
+  }
+
+ public:
+  KeyDecoder(const char* data, int len) : data_((const uint8_t*) data), len_(len), pos_(0) {}
+
+  template<int N>
+  explicit KeyDecoder(const FixedKey<N>& key) : data_(key.data), len_(N), pos_(0) {}
+
+  template<typename T>
+  T read() {
+    static_assert(std::is_arithmetic_v<T>, "unsupported column type");
+    T value;
+    if constexpr(std::is_floating_point_v<T>) {
+      typedef std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t> U;
+      value = float_reconvert<T, U>(read_big_endian<U>());
+    } else {
+      typedef std::make_unsigned_t<T> U;
+      U u = read_big_endian<U>();
+      if constexpr(std::is_signed_v<T>)
+        u ^= U(1) << (sizeof(U) * 8 - 1);
+      value = (T) u;
+    }
+    return value;
+  }
+
+  std::string read_string() {
+    std::string str;
+    while(true) {
+      if(pos_ + 1 >= len_) throw std::out_of_range("unterminated string column");
+      uint8_t c = data_[pos_++];
+      if(c != 0) {
+        str.push_back((char) c);
+        continue;
+      }
+      uint8_t esc = data_[pos_++];
+      if(esc == 0x01) break; // terminator
+      if(esc != 0xFF) throw std::out_of_range("invalid escape in string column");
+      str.push_back(0);
+    }
+    return str;
+  }
+
+  bool done() const { return pos_ >= len_; }
+};
+
 }
 
 #endif //INDEXRESEARCH_CONSTANT_H
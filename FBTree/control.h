@@ -9,34 +9,160 @@
 
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <vector>
 #include <cassert>
 #include "debug.h"
 #include "config.h"
 
 namespace FeatureBTree {
 
+/* queue node of the queue-based latch (Config::kLatchMode == QUEUE), similar
+ * to OMCS_OFFSET in OptiQL, a waiter is identified by a 10-bit id instead of a
+ * pointer, so the queue tail fits in the control word besides the flags and the
+ * version; each thread owns one queue node, since it waits for at most one latch
+ * at a time and its queue node is free again once the latch is acquired */
+struct alignas(64) LatchQNode {
+  std::atomic<uint32_t> next_; // id of the successor, 0: none
+  std::atomic<bool> wait_;     // waiting for the hand-over of the predecessor
+};
+
+class LatchQueue {
+ public:
+  static constexpr int kQNodeBits = 10;
+  static constexpr uint32_t kNumQNodes = 0x01u << kQNodeBits; // id 0 is reserved
+
+  static LatchQNode* qnode(uint32_t id) { return qnodes_ + id; }
+
+  /* queue node id of current thread, recycled when the thread exits,
+   * 0 if all ids are in use, then the thread falls back to backoff */
+  static uint32_t local_id() {
+    static thread_local Slot slot;
+    return slot.id_;
+  }
+
+ private:
+  struct Slot {
+    uint32_t id_;
+
+    Slot() : id_(0) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if(!free_.empty()) id_ = free_.back(), free_.pop_back();
+      else if(next_ < kNumQNodes) id_ = next_++;
+    }
+
+    ~Slot() {
+      if(id_ == 0) return;
+      std::lock_guard<std::mutex> guard(mutex_);
+      free_.push_back(id_);
+    }
+  };
+
+  inline static LatchQNode qnodes_[kNumQNodes];
+  inline static std::mutex mutex_;
+  inline static std::vector<uint32_t> free_;
+  inline static uint32_t next_ = 1;
+};
+
 class Control {
   std::atomic<uint64_t> control_;
 
+  static constexpr bool kQueueLatch = Config::kLatchMode == QUEUE;
+
+  static constexpr uint64_t kHeatMask = 0xE0;   // contention heat of leaf node, saturated at 7
   static constexpr uint64_t kOrderBit = 0x10;   // kv pairs in leaf node are ordered
   static constexpr uint64_t kLeafBit = 0x8;     // current node is a leaf node
   static constexpr uint64_t kSiblingBit = 0x4;  // current node has sibling node
   static constexpr uint64_t kLockBit = 0x2;     // concurrency control
   static constexpr uint64_t kDelBit = 0x1;      // current node has been deleted
 
-  static constexpr uint64_t kSplitMask = 0x0000'0000'00FF'FF00;   // current node is splitting, only used by leaf node
-  static constexpr uint64_t kVersionMask = 0xFFFF'FFFF'FF00'0000; // node version, monotone increasing
-
+  static constexpr uint64_t kClassMask = 0x0000'0000'00C0'0000;   // size class of leaf node, see Config::kLeafClassOpt
+  static constexpr uint64_t kLastMask = 0x0000'0000'003F'8000;    // slot of the latest insert into leaf node plus 1
+  static constexpr uint64_t kSplitMask = 0x0000'0000'0000'7F00;   // current node is splitting, only used by leaf node
+  /* node version, monotone increasing; with the queue-based latch, the low 10 bits
+   * of version hold the id of the queue tail, and the version shrinks to 30 bits:
+   * an optimistic read is fooled only if the node is updated a multiple of 2^30
+   * (~1e9) times while the reader is inside its read section, 2^40 without it */
+  static constexpr uint64_t kTailMask = kQueueLatch ? 0x0000'0003'FF00'0000 : 0;
+  static constexpr uint64_t kVersionMask = kQueueLatch ? 0xFFFF'FFFC'0000'0000 : 0xFFFF'FFFF'FF00'0000;
+
+  static constexpr uint64_t kHeatOne = 0x20;
+  static constexpr uint64_t kClassOne = 0x0000'0000'0040'0000;
+  static constexpr uint64_t kLastOne = 0x0000'0000'0000'8000;
   static constexpr uint64_t kSplitOne = 0x0000'0000'0000'0100;
-  static constexpr uint64_t kVersionOne = 0x0000'0000'0100'0000;
+  static constexpr uint64_t kTailOne = 0x0000'0000'0100'0000;
+  static constexpr uint64_t kVersionOne = kQueueLatch ? 0x0000'0004'0000'0000 : 0x0000'0000'0100'0000;
 
   static constexpr std::memory_order load_order = std::memory_order_acquire;
   static constexpr std::memory_order store_order = std::memory_order_release;
 
+  static_assert(kTailMask == (LatchQueue::kNumQNodes - 1) * kTailOne || !kQueueLatch);
+  static_assert(Config::kLeafSize < kLastMask / kLastOne);
+
+  static void relax() { __builtin_ia32_pause(); }
+
+  // the addend turning the latest insert slot into last
+  uint64_t last_delta(int last) {
+    return (uint64_t(last + 1) - (control_.load(load_order) & kLastMask) / kLastOne) * kLastOne;
+  }
+
+  void backoff(int& spin, int& limit) {
+    if(kQueueLatch) { // writers are queued, the latch is released soon
+      relax(); // yield sometimes, in case the holder has been descheduled
+      if(++spin % 128 == 0) std::this_thread::yield();
+      return;
+    }
+
+    if(spin++ >= limit) {
+      using namespace std::chrono_literals;
+      if(limit == Config::kSpinInit) std::this_thread::yield();
+      else std::this_thread::sleep_for(1us);
+      spin = 0, limit += Config::kSpinInc;
+    }
+  }
+
+  void latch_queued(uint32_t id) {
+    int spin = 0, limit = Config::kSpinInit;
+    LatchQNode* qnode = LatchQueue::qnode(id);
+    qnode->next_.store(0, std::memory_order_relaxed);
+    qnode->wait_.store(true, std::memory_order_relaxed);
+
+    // enqueue: swap the queue tail
+    uint64_t expected = control_.load(load_order);
+    while(!control_.compare_exchange_weak(expected, (expected & ~kTailMask) | id * kTailOne));
+    uint32_t prev = (expected & kTailMask) / kTailOne;
+
+    if(prev != 0) { // wait until the predecessor acquires the latch
+      LatchQueue::qnode(prev)->next_.store(id, store_order);
+      while(qnode->wait_.load(load_order)) backoff(spin, limit);
+    }
+
+    // queue head, the only waiter polling the control word
+    while(true) {
+      expected = control_.load(load_order);
+      if(expected & kLockBit) {
+        backoff(spin, limit);
+        continue;
+      }
+
+      bool last = (expected & kTailMask) == id * kTailOne;
+      uint64_t desired = last ? ((expected & ~kTailMask) | kLockBit) : (expected | kLockBit);
+      if(control_.compare_exchange_weak(expected, desired)) {
+        if(!last) { // hand over the queue head to the successor
+          uint32_t next;
+          while((next = qnode->next_.load(load_order)) == 0) backoff(spin, limit);
+          LatchQueue::qnode(next)->wait_.store(false, store_order);
+        }
+        return;
+      }
+    }
+  }
+
  public:
   Control() = delete;
 
-  explicit Control(bool is_leaf) : control_(is_leaf ? kLeafBit : 0) {}
+  explicit Control(bool is_leaf, int size_class = 0)
+    : control_((is_leaf ? kLeafBit : 0) | size_class * kClassOne) {}
 
   bool ordered() { return control_.load(load_order) & kOrderBit; }
 
@@ -57,8 +183,18 @@ class Control {
    * jump to its sibling leaf node */
   bool is_splitting() { return control_.load(load_order) & kSplitMask; }
 
+  // leaf node holds at most kLeafSize >> size_class kv pairs, fixed at construction
+  int size_class() { return (control_.load(load_order) & kClassMask) / kClassOne; }
+
   uint64_t load_version() { return control_.load(load_order) & kVersionMask; }
 
+  /* slot of the latest insert into leaf node, -1 if unknown (the node was split
+   * or the key was removed since), a hint for choosing the split point */
+  int last_insert() { return int((control_.load(load_order) & kLastMask) / kLastOne) - 1; }
+
+  // record slot last (-1: unknown) as the latest insert, current node must be latched
+  void set_last_insert(int last) { control_.fetch_add(last_delta(last)); }
+
   uint64_t begin_read() {
     // begin atomic reading node, if locked, waiting for other thread
     int spin = 0, limit = Config::kSpinInit;
@@ -69,15 +205,27 @@ class Control {
       }
 
       // waiting for other threads' modification
-      if(spin++ >= limit) {
-        using namespace std::chrono_literals;
-        if(limit == Config::kSpinInit) std::this_thread::yield();
-        else std::this_thread::sleep_for(1us);
-        spin = 0, limit += Config::kSpinInc;
-      }
+      backoff(spin, limit);
     }
   }
 
+  // version hasn't changed and node is not latched, never wait
+  bool validate(uint64_t version) {
+    uint64_t control = control_.load(load_order);
+    return (control & kLockBit) == 0 && (control & kVersionMask) == version;
+  }
+
+  /* validate, and clear the order bit in the same CAS, so a latched sort can't
+   * set it in between; for appending to the delta buffer without the latch */
+  bool validate_unorder(uint64_t version) {
+    uint64_t control = control_.load(load_order);
+    while((control & kLockBit) == 0 && (control & kVersionMask) == version) {
+      if((control & kOrderBit) == 0) return true;
+      if(control_.compare_exchange_weak(control, control & ~kOrderBit)) return true;
+    }
+    return false;
+  }
+
   bool end_read(uint64_t version) {
     // end atomic reading node
     int spin = 0, limit = Config::kSpinInit;
@@ -85,12 +233,7 @@ class Control {
 
     // if locked, waiting for other threads' modification
     while((control & kLockBit) != 0) {
-      if(spin++ >= limit) {
-        using namespace std::chrono_literals;
-        if(limit == Config::kSpinInit) std::this_thread::yield();
-        else std::this_thread::sleep_for(1us);
-        spin = 0, limit += Config::kSpinInc;
-      }
+      backoff(spin, limit);
       control = control_.load(load_order);
     }
 
@@ -123,6 +266,28 @@ class Control {
     DEBUG_COND_ERROR((old & kOrderBit) == 0, "fatal error, kv pairs were originally unordered");
   }
 
+  // count contended latch acquisitions, true if the heat is saturated
+  bool heat_up() {
+    uint64_t expected = control_.load(load_order);
+    while((expected & kHeatMask) != kHeatMask) {
+      if(control_.compare_exchange_weak(expected, expected + kHeatOne))
+        return ((expected + kHeatOne) & kHeatMask) == kHeatMask;
+    }
+    return true;
+  }
+
+  // halve the heat, current node must be latched
+  void cool_down() {
+    uint64_t expected = control_.load(load_order);
+    while(expected & kHeatMask) {
+      uint64_t heat = ((expected & kHeatMask) >> 1) & kHeatMask;
+      if(control_.compare_exchange_weak(expected, (expected & ~kHeatMask) | heat)) break;
+    }
+  }
+
+  // contended latch acquisitions counted so far, at most 7
+  int heat() { return (control_.load(load_order) & kHeatMask) / kHeatOne; }
+
   void set_delete() {
     uint64_t old = control_.fetch_add(kDelBit);
     DEBUG_COND_ERROR((old & kDelBit) != 0, "fatal error, delete a node that had been deleted!");
@@ -138,22 +303,32 @@ class Control {
     DEBUG_COND_ERROR((old & kSiblingBit) == 0, "fatal error, current node doesn't have sibling!");
   }
 
-  void latch_exclusive() {
+  // return true if the latch was contended
+  bool latch_exclusive() {
+    if(kQueueLatch) {
+      uint64_t expected = control_.load(load_order);
+      if((expected & (kLockBit | kTailMask)) == 0 &&
+         control_.compare_exchange_strong(expected, expected | kLockBit))
+        return false; // uncontended
+      uint32_t id = LatchQueue::local_id();
+      if(id != 0) {
+        latch_queued(id);
+        return true;
+      }
+    }
+
     int spin = 0, limit = Config::kSpinInit;
+    bool contended = kQueueLatch;
     while(true) {
       // using backoff, so reload control before cas
       uint64_t expected = control_.load(load_order);
       uint64_t desired = expected | kLockBit;
       if((expected & kLockBit) == 0 &&
          control_.compare_exchange_strong(expected, desired))
-        break;
+        return contended;
 
-      if(spin++ >= limit) {
-        using namespace std::chrono_literals;
-        if(limit == Config::kSpinInit) std::this_thread::yield();
-        else std::this_thread::sleep_for(1us);
-        spin = 0, limit += Config::kSpinInc;
-      }
+      contended = true;
+      backoff(spin, limit);
     }
   }
 
@@ -161,6 +336,11 @@ class Control {
     control_.fetch_add(kVersionOne);
   }
 
+  // update version and record the latest insert in one step, see set_last_insert
+  void update_version(int last) {
+    control_.fetch_add(kVersionOne + last_delta(last));
+  }
+
   void unlatch_exclusive() {
     DEBUG_COND_ERROR((control_.load(load_order) & kLockBit) == 0, "unlatch error");
     control_.fetch_sub(kLockBit);
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2022-Present, Chen Yuan <yuan.chen@whu.edu.cn>
+ *
+ * All rights reserved. No warranty, explicit or implicit, provided.
+ */
+
+#ifndef INDEXRESEARCH_DIRECTORY_H
+#define INDEXRESEARCH_DIRECTORY_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include "config.h"
+#include "constant.h"
+
+namespace FeatureBTree {
+
+using util::hash;
+
+/* hash directory of leaf nodes for point lookups (Config::kLeafDirectory), similar
+ * to the meta table of wormhole: a direct-mapped table from key prefixes (integer
+ * keys sharing key >> kDirectoryShift, other keys themselves) to a leaf node that
+ * held a key of the prefix; a live leaf node never loses its lower bound (a split
+ * moves its upper part right, a merge moves its right sibling in), so a leaf node
+ * that once held a key not greater than the target key is a valid start point of
+ * the b-link walk to the right; entries are hints, lookups fall back to traversal
+ * from the root on misses; once a leaf node is deleted (merged or resized), the
+ * generation is increased before the node is retired, which invalidates all entries
+ * written before, so an entry never points to a reclaimed node */
+template<typename K>
+class LeafDirectory {
+  static constexpr int kBits = Config::kDirectoryBits;
+  static constexpr int kShift = Config::kDirectoryShift;
+  static constexpr size_t kSize = 0x01ul << kBits;
+
+  struct alignas(32) Entry {
+    std::atomic<uint64_t> version_; // seqlock, odd while being written
+    uint64_t gen_;                  // generation of the directory when written
+    K key_;                         // a key held by leaf_ when written
+    void* leaf_;
+  };
+
+  std::atomic<uint64_t> gen_;
+  Entry* entries_;
+
+  static K prefix(K key) {
+    if constexpr(std::is_integral_v<K> || std::is_same_v<K, uint128_t>) return key >> kShift;
+    else return key;
+  }
+
+  static size_t slot(K key) {
+    uint64_t h = hash(prefix(key)) * 0x9E37'79B9'7F4A'7C15ul; // spread the bits
+    return h >> (64 - kBits);
+  }
+
+ public:
+  LeafDirectory() : gen_(1) {
+    entries_ = (Entry*) malloc(sizeof(Entry) * kSize);
+    memset((void*) entries_, 0, sizeof(Entry) * kSize); // generation 0 is invalid
+  }
+
+  ~LeafDirectory() { free(entries_); }
+
+  size_t size() { return sizeof(Entry) * kSize; }
+
+  // some leaf node is deleted, must be called before it is retired
+  void invalidate() { gen_.fetch_add(1, std::memory_order_acq_rel); }
+
+  /* a leaf node to start the b-link walk for key, or null, gen is the current
+   * generation, which must be passed to record the leaf node holding key */
+  void* find(K key, uint64_t& gen) {
+    gen = gen_.load(std::memory_order_acquire);
+    Entry* entry = entries_ + slot(key);
+    uint64_t version = entry->version_.load(std::memory_order_acquire);
+    if(version & 0x01ul) return nullptr; // being written
+    uint64_t egen = entry->gen_;
+    K ekey = entry->key_;
+    void* leaf = entry->leaf_;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(entry->version_.load(std::memory_order_relaxed) != version) return nullptr;
+    if(egen != gen || key < ekey || !(prefix(ekey) == prefix(key))) return nullptr;
+    return leaf;
+  }
+
+  /* record the leaf node holding key, gen is returned by find before traversal;
+   * the smallest key of a prefix is kept, so other keys of it walk right, unless
+   * replace (the walk from the recorded leaf node has become long after splits) */
+  void record(K key, void* leaf, uint64_t gen, bool replace) {
+    Entry* entry = entries_ + slot(key);
+    uint64_t version = entry->version_.load(std::memory_order_acquire);
+    if(version & 0x01ul) return; // contended, it is only a hint
+    if(!replace && entry->gen_ == gen && prefix(entry->key_) == prefix(key)
+       && !(key < entry->key_)) return;
+    if(!entry->version_.compare_exchange_strong(version, version + 1)) return;
+    std::atomic_thread_fence(std::memory_order_release);
+    entry->gen_ = gen, entry->key_ = key, entry->leaf_ = leaf;
+    entry->version_.store(version + 2, std::memory_order_release);
+  }
+};
+
+}
+
+#endif //INDEXRESEARCH_DIRECTORY_H
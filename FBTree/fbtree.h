@@ -9,13 +9,32 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <map>
 #include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <atomic>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
 #include "config.h"
 #include "constant.h"
 #include "control.h"
 #include "inode.h"
 #include "lnode.h"
+#include "directory.h"
+#include "model.h"
+#include "checkpoint.h"
+#include "wal.h"
+#include "pager.h"
+#include "mvcc.h"
 #include "type.h"
 #include "epoch.h"
 
@@ -26,17 +45,51 @@ using util::KVPair;
 using util::Epoch;
 using util::EpochGuard;
 
+// values which can be updated in place by atomic builtins on the plain value (what std::atomic_ref
+// of C++20 is built on), see FBTree::merge; a V is not an std::atomic<V>, so other types are copied
+template<typename V>
+struct AtomicValue : std::bool_constant<std::is_integral_v<V> && sizeof(V) <= sizeof(uint64_t)> {};
+
 template<typename K, typename V>
 class alignas(64) FBTree {
   typedef FeatureBTree::LeafNode<K, V> LeafNode;
   typedef FeatureBTree::InnerNode<K> InnerNode;
   static constexpr int kMaxHeight = 13;
   static constexpr int kPrefetchSize = 3;
+  static constexpr bool kRootModel = Config::kRootModel && std::is_integral_v<K> && sizeof(K) <= 8;
+  static constexpr bool kLoggable = std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>;
+  static constexpr bool kPageable = Config::kPagingOpt && kLoggable;
+  // values merged in place by atomic operations, see merge_value
+  static constexpr bool kInPlace = AtomicValue<V>::value && !Config::kMvccOpt;
 
   void* root_;                  // root node
   int tree_depth_;              // tree depth/height
   Epoch* epoch_;                // epoch-based memory reclaimer
   void* root_track_[kMaxHeight];// track the root node
+  LeafDirectory<K>* directory_; // leaf nodes of key prefixes, see Config::kLeafDirectory
+  std::atomic<RootModel<K>*> model_; // predicts inner nodes, see Config::kRootModel
+  std::atomic<uint64_t> inner_deletes_; // deleted inner nodes, invalidate the model
+  std::atomic<uint64_t> inner_splits_;  // split inner nodes, the model gets out of date
+  std::atomic<bool> modeling_;          // some thread is building the model
+
+  RedoLog<K, V>* log_;       // redo log of updates, see open_log
+  std::string log_path_;
+  uint64_t log_seq_;         // the current log segment
+  std::mutex log_mutex_;     // serializes checkpoints
+  std::atomic<uint64_t> ckpt_gen_; // checkpoint generation, stamps modified leaf nodes
+  uint64_t dirty_from_;            // leaf nodes of greater stamps are dirty, see Config::kDirtyOpt
+
+  Pager<K, V>* pager_;       // pages of cold leaf nodes, see open_pager
+  K clock_hand_;             // the high key of the leaf node last swept, see evict
+  bool clock_set_;
+  std::atomic<size_t> leaf_num_; // leaf nodes, counted for evict only if kPageable
+  std::mutex clock_mutex_;   // serializes sweeps
+  VersionClock versions_;    // timestamps of writes and snapshots, see Snapshot
+
+  std::thread maintainer_;        // maintenance thread, see start_maintenance
+  std::atomic<bool> maintaining_; // merges are deferred to the maintenance thread
+  std::mutex maintain_mutex_;
+  std::condition_variable maintain_cv_;
 
  public:
   typedef util::KVPair<K, V> KVPair;
@@ -47,6 +100,8 @@ class alignas(64) FBTree {
     KVPair* kv_;       // the kv pointed by current iterator, null means the end
     int pos_;          // the ordinal of kv in current node (ordered view)
 
+    friend class FBTree;
+
    public:
     iterator() : node_(nullptr), kv_(nullptr) {}
 
@@ -75,11 +130,15 @@ class alignas(64) FBTree {
         node = (LeafNode*) (node->sibling());
         if(node == nullptr) break;
 
-        // first try to optimistically access the first kv in sibling
+        // first try to optimistically access the first kv in sibling, paged in before the read section
+        node->fault_in();
         version = ((Control*) node)->begin_read();
         std::tie(next, pos, version) = node->access(nullptr, 0, version);
         // left node in a consistent state, succeed to get next kv
-        if(((Control*) node_)->end_read(version_)) break;
+        if(((Control*) node_)->end_read(version_)) {
+          if(next != nullptr) break;
+          continue; // an empty node left by a deferred merge, go on to its sibling
+        }
 
         // enforce using bound to get next kv
         std::tie(next, pos, version) = node->access(kv_, 0, 0);
@@ -100,6 +159,289 @@ class alignas(64) FBTree {
     KVPair& operator*() { return *kv_; }
   };
 
+  /* append mode for (near-)monotonic keys, used by one thread: new kvs are
+   * staged in a thread-local run, and linked into the tree by upsert_batch
+   * once kAppendSize kvs are staged, so threads appending to the rightmost
+   * leaf node latch it once per run instead of once per kv; staged kvs are
+   * invisible to other threads until flush, old kvs are retired by epoch */
+  class Appender {
+    FBTree* tree_;
+    std::vector<KVPair*> kvs_;
+    std::vector<KVPair*> olds_;
+
+   public:
+    explicit Appender(FBTree& tree) : tree_(&tree) {
+      kvs_.reserve(Config::kAppendSize);
+      olds_.resize(Config::kAppendSize);
+    }
+
+    // like other operations, it must be destructed in the epoch guard
+    ~Appender() { flush(); }
+
+    // kv should be allocated by malloc
+    void upsert(KVPair* kv) {
+      kvs_.push_back(kv);
+      if(kvs_.size() >= Config::kAppendSize) flush();
+    }
+
+    template<typename Value>
+    void upsert(K key, const Value& value) {
+      void* kv = malloc(sizeof(KVPair));
+      new(kv) KVPair{key, value};
+      upsert((KVPair*) kv);
+    }
+
+    void flush() {
+      if(kvs_.empty()) return;
+      // stable, so the later kv of a duplicate key wins
+      std::stable_sort(kvs_.begin(), kvs_.end(), [](KVPair* a, KVPair* b) {
+        return a->key < b->key;
+      });
+      tree_->upsert_batch(kvs_.data(), kvs_.size(), olds_.data());
+      for(int i = 0; i < kvs_.size(); i++)
+        if(olds_[i] != nullptr) tree_->epoch_->retire(olds_[i]);
+      kvs_.clear();
+    }
+  };
+
+  /* a consistent view of the tree as of its creation (Config::kMvccOpt): writes
+   * are stamped, and while some snapshot is older than a write, the kv it
+   * replaces is kept in the undo list of the leaf node, so a long scan neither
+   * blocks writers nor observes a state that never existed as a whole; undo
+   * entries are dropped by later writes to the leaf node and by maintain */
+  class Snapshot {
+    FBTree* tree_;
+    uint64_t ts_;
+
+   public:
+    explicit Snapshot(FBTree& tree) : tree_(&tree), ts_(tree.versions_.acquire()) {
+      static_assert(Config::kMvccOpt && sizeof(K) > 0, "snapshots need Config::kMvccOpt");
+    }
+
+    ~Snapshot() { tree_->versions_.release(ts_); }
+
+    Snapshot(const Snapshot&) = delete;
+
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    /* apply fn(key, value) to kv pairs of keys in [low, high] in key order as of
+     * the snapshot, stop once fn returns false; leaf nodes are copied in batches,
+     * each in its own epoch guard, so it is called outside the epoch guard */
+    template<typename F>
+    void scan(const K& low, const K& high, F&& fn) { tree_->snapshot_scan(ts_, low, high, fn); }
+  };
+
+  /* optimistic multi-key transaction (basic type keys), like Silo, used by one
+   * thread in one epoch guard: a read records the version of its leaf node and
+   * the kv it found, writes are buffered; commit latches the leaf nodes of the
+   * writes in key order (the order of b-link crabbing, so no deadlock), checks
+   * that every read leaf node kept its version (or, latched by commit itself, its
+   * kv of the key) and installs the writes before releasing any latch, so
+   * committed transactions are serializable; single-key operations still take
+   * their own fast paths, and the writes are logged in one group (see open_log) */
+  class Transaction {
+    struct Read {
+      void* node_;       // the leaf node of the key
+      uint64_t version_; // of node when read
+      K key_;
+      KVPair* kv_;       // the kv found, null if absent
+    };
+
+    FBTree* tree_;
+    std::vector<Read> reads_;
+    std::map<K, KVPair*> writes_; // null for remove
+
+    bool validate(std::vector<void*>& latched) {
+      for(Read& read : reads_) {
+        Control* control = tree_->control(read.node_);
+        bool mine = std::find(latched.begin(), latched.end(), read.node_) != latched.end();
+        if(mine ? control->load_version() != read.version_ : !control->validate(read.version_)) return false;
+        // updates replace kvs without changing versions; faulting would latch a
+        // node that is either held here or may be left of the held ones
+        if(tree_->leaf(read.node_)->lookup(read.key_, false) != read.kv_) return false;
+        if(!mine && !control->validate(read.version_)) return false;
+      }
+      return true;
+    }
+
+   public:
+    explicit Transaction(FBTree& tree) : tree_(&tree) {}
+
+    ~Transaction() { abort(); }
+
+    Transaction(const Transaction&) = delete;
+
+    Transaction& operator=(const Transaction&) = delete;
+
+    // read the value of key into value, return false if the key doesn't exist
+    bool read(const K& key, V& value) {
+      auto it = writes_.find(key);
+      if(it != writes_.end()) { // read its own write
+        if(it->second == nullptr) return false;
+        value = it->second->value;
+        return true;
+      }
+
+      K cvt_key = encode_convert(key);
+      void* node = tree_->root_;
+      while(!tree_->is_leaf(node)) tree_->inner(node)->to_next(cvt_key, node);
+      uint64_t version;
+      KVPair* kv;
+      do {
+        version = tree_->control(node)->begin_read();
+        while(tree_->leaf(node)->to_sibling(key, node)) {
+          version = tree_->control(node)->begin_read();
+        }
+        kv = tree_->leaf(node)->lookup(key);
+      } while(!tree_->control(node)->end_read(version));
+
+      reads_.push_back(Read{node, version, key, kv});
+      if(kv == nullptr) return false;
+      value = kv->value;
+      return true;
+    }
+
+    template<typename Value>
+    void write(const K& key, const Value& value) {
+      void* kv = malloc(sizeof(KVPair));
+      new(kv) KVPair{key, value};
+      KVPair*& slot = writes_[key];
+      if(slot != nullptr) {
+        slot->~KVPair();
+        free(slot);
+      }
+      slot = (KVPair*) kv;
+    }
+
+    void remove(const K& key) {
+      KVPair*& slot = writes_[key];
+      if(slot != nullptr) {
+        slot->~KVPair();
+        free(slot);
+      }
+      slot = nullptr;
+    }
+
+    // drop reads and writes, the transaction can be reused
+    void abort() {
+      for(auto& [key, kv] : writes_) {
+        if(kv == nullptr) continue;
+        kv->~KVPair();
+        free(kv);
+      }
+      writes_.clear();
+      reads_.clear();
+    }
+
+    /* return true if committed, false if some read is stale, then nothing is
+     * written; either way the transaction is reset for the caller to retry */
+    bool commit() {
+      assert(tree_->epoch_->guarded());
+      if(writes_.empty()) {
+        std::vector<void*> latched;
+        bool ok = validate(latched);
+        abort();
+        return ok;
+      }
+
+      // serialize with single-key operations of the same keys in the log order
+      std::vector<std::mutex*> stripes;
+      if constexpr(kLoggable) {
+        if(tree_->log_ != nullptr) {
+          for(auto& [key, kv] : writes_) stripes.push_back(&tree_->log_->stripe(key));
+          std::sort(stripes.begin(), stripes.end());
+          stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+          for(std::mutex* stripe : stripes) stripe->lock();
+        }
+      }
+
+      // latch leaf nodes of the writes from left to right
+      std::vector<void*> latched, targets;
+      std::vector<std::vector<void*>> paths;
+      for(auto& [key, kv] : writes_) {
+        void* node, * next;
+        if(!latched.empty() && !tree_->leaf(latched.back())->to_sibling(key, next)) {
+          paths.push_back(paths.back());
+          targets.push_back(latched.back());
+          continue;
+        }
+        paths.emplace_back();
+        K cvt_key = encode_convert(key);
+        node = tree_->root_;
+        while(!tree_->is_leaf(node)) {
+          void* work = node;
+          if(!tree_->inner(work)->to_next(cvt_key, node)) paths.back().push_back(work);
+        }
+        // the traversal only fills the path, latching its leaf node could go left
+        // of the latched ones, so move right from the last latched node instead
+        bool held = !latched.empty();
+        if(held) node = latched.back();
+        else tree_->latch_exclusive(node);
+        while(tree_->leaf(node)->to_sibling(key, next)) {
+          tree_->latch_exclusive(next);
+          if(!held) tree_->unlatch_exclusive(node);
+          node = next, held = false;
+        }
+        tree_->leaf(node)->page_in(); // faults would latch it again
+        latched.push_back(node);
+        targets.push_back(node);
+      }
+
+      bool ok = validate(latched);
+      int levels = 0;
+      uint64_t lsn = 0;
+      if(ok) {
+        if constexpr(kLoggable) {
+          if(tree_->log_ != nullptr) {
+            std::vector<std::tuple<LogOp, K, const V*>> records;
+            for(auto& [key, kv] : writes_)
+              records.emplace_back(kv ? kLogUpsert : kLogRemove, key, kv ? &kv->value : nullptr);
+            lsn = tree_->log_->append(records);
+          }
+        }
+
+        uint64_t ts = 0, floor = 0;
+        if constexpr(Config::kMvccOpt) ts = tree_->versions_.tick(), floor = tree_->versions_.floor();
+        int i = 0;
+        for(auto& [key, kv] : writes_) {
+          void* node = targets[i], * next, * rnode = nullptr;
+          K mid;
+          // new right nodes of this commit are latched
+          while(tree_->leaf(node)->to_sibling(key, next)) node = next;
+          if(Config::kLeafClassOpt && node == tree_->root_) {
+            void* copy = tree_->resize_root(node); // a single leaf node, all writes go to it
+            if(copy != node) latched.assign(1, copy), std::fill(targets.begin(), targets.end(), copy);
+            node = copy;
+          }
+          KVPair* old;
+          if(kv != nullptr) old = tree_->leaf(node)->upsert(kv, rnode, mid);
+          else old = tree_->leaf(node)->remove(key, next, mid, true); // merges are left to maintenance
+          if(kv != nullptr || old != nullptr) {
+            tree_->record(node, rnode, key, old, ts, floor);
+            tree_->touch(node);
+          }
+          if(old != nullptr) tree_->epoch_->retire(old);
+          if(rnode != nullptr) {
+            tree_->touch(rnode);
+            tree_->latch_exclusive(rnode);
+            latched.push_back(rnode);
+            levels = std::max(levels, tree_->split_up(node, rnode, mid, paths[i], true));
+          }
+          kv = nullptr, i += 1; // owned by the tree
+        }
+      }
+
+      for(void* node : latched) tree_->unlatch_exclusive(node);
+      for(std::mutex* stripe : stripes) stripe->unlock();
+      if constexpr(kLoggable) {
+        if(ok && tree_->log_ != nullptr) tree_->log_->commit(lsn);
+      }
+      if(kRootModel && levels > 1) tree_->model_build(false);
+      abort();
+      return ok;
+    }
+  };
+
  private:
   Control* control(void* node) { return (Control*) node; }
 
@@ -139,11 +481,13 @@ class alignas(64) FBTree {
       bool unordered = false;
 
       do {
+        leaf(node)->fault_in(); // before the read section, faults latch
         version = control(node)->begin_read();
         while(leaf(node)->to_sibling(key, node)) {
           version = control(node)->begin_read();
         }
-        if(!control(node)->ordered()) {
+        // a sibling or a racing eviction left it paged out, which the latched path reads back
+        if(!control(node)->ordered() || (Config::kPagingOpt && leaf(node)->paged())) {
           unordered = true;
           break;
         }
@@ -180,71 +524,14 @@ class alignas(64) FBTree {
     return iterator((LeafNode*) node, version, kv, pos);
   }
 
- public:
-  FBTree() {
-    root_ = malloc(sizeof(LeafNode));
-    new(root_) LeafNode();
-    tree_depth_ = 1;
-    root_track_[0] = root_;
-    epoch_ = new Epoch();
-  }
-
-  //By default, kv is destruct and then the memory block of kv is freed
-  ~FBTree() { // recursive destructor result in stackoverflow
-    for(int rid = 0; rid < tree_depth_; rid++) {
-      void* node = root_track_[rid], * sibling;
-      while(node) {
-        if(is_leaf(node)) {
-          leaf(node)->~LeafNode();
-          sibling = leaf(node)->sibling();
-        } else {
-          inner(node)->~InnerNode();
-          sibling = inner(node)->sibling();
-        }
-        free(node);
-        node = sibling;
-      }
-    }
-    delete epoch_;
-  }
-
-  void node_parameter() { Constant<K>::node_parameter(); }
-
-  void statistics() {
-    std::map<std::string, double> stat;
-    stat["index depth"] = tree_depth_;
-    for(int rid = 0; rid < tree_depth_; rid++) {
-      void* node = root_track_[rid];
-      while(node) {
-        if(is_leaf(node)) {
-          leaf(node)->statistic(stat);
-          node = leaf(node)->sibling();
-        } else {
-          inner(node)->statistic(stat);
-          node = inner(node)->sibling();
-        }
-      }
-    }
-    stat["load factor"] = stat["kv pair num"] / (stat["leaf num"] * Constant<K>::kLeafSize);
-
-    std::cout << "-- FBTree statistics" << std::endl;
-    for(auto item : stat) {
-      if(item.first == "index size") {
-        size_t GB = 1024ul * 1024 * 1024;
-        std::cout << "  -- " << item.first << ": " << item.second / GB << " GB" << std::endl;
-      } else {
-        std::cout << "  -- " << item.first << ": " << item.second << std::endl;
-      }
-    }
-  }
-
-  Epoch& get_epoch() { return *epoch_; }
-
-  // kv should be allocated by malloc
-  KVPair* upsert(KVPair* kv) {
-    assert(epoch_->guarded());
+  /* upsert a run of kvs sorted by key in one latch section of the leaf node of
+   * kvs[0], stop at the first key beyond the leaf node or at the first split,
+   * olds[i] is the old kv of kvs[i] (kept, and kvs[i] is not linked, unless
+   * overwrite), return the number of upserted kvs */
+  int upsert_run(KVPair** kvs, int n, KVPair** olds, bool overwrite = true) {
     std::vector<void*> path_stack;
     path_stack.reserve(tree_depth_);
+    KVPair* kv = kvs[0];
     K mid = encode_convert(kv->key);
     void* work, * current = root_;
 
@@ -257,17 +544,49 @@ class alignas(64) FBTree {
     }
 
     // reach leaf node
-    latch_exclusive(current);
+    if(Config::kDeltaOpt && n == 1 && overwrite) { // a hot leaf node buffers new kv pairs
+      uint64_t version = control(current)->begin_read();
+      while(leaf(current)->to_sibling(kv->key, current)) {
+        version = control(current)->begin_read();
+      }
+      if(leaf(current)->append(kv, olds[0], version)) {
+        touch(current);
+        return 1;
+      }
+    }
+
+    if(control(current)->latch_exclusive() && Config::kDeltaOpt)
+      leaf(current)->heat_up();
     while(leaf(current)->to_sibling(kv->key, work)) {
       latch_exclusive(work);
       unlatch_exclusive(current);
       current = work;
     }
 
-    int index, rootid = 0;// rootid: reverse traversal index
+    int count = 0;
     void* rnode, * next;  // rnode: the new node
-    KVPair* old = leaf(current)->upsert(kv, rnode, mid);
+    do {
+      if(Config::kLeafClassOpt && current == root_) current = resize_root(current);
+      olds[count] = leaf(current)->upsert(kvs[count], rnode, mid, overwrite);
+      if(overwrite || olds[count] == nullptr) record(current, rnode, kvs[count]->key, olds[count]);
+      touch(current);
+      if(rnode != nullptr) touch(rnode); // the new right node
+      count += 1; // the following keys are not less than kvs[0]
+    } while(rnode == nullptr && count < n && !leaf(current)->to_sibling(kvs[count]->key, next));
+
+    int rootid = split_up(current, rnode, mid, path_stack, false);
+    if(kRootModel && rootid > 1) model_build(false); // inner nodes were split
+    return count;
+  }
 
+  /* insert rnode, the new right node of the latched node current, into upper
+   * levels (path_stack holds inner nodes passed by the traversal), splitting them
+   * in turn; unlatch current (unless keep) and the top node modified, return the
+   * number of levels modified */
+  int split_up(void* current, void* rnode, K mid, std::vector<void*>& path_stack, bool keep) {
+    void* bottom = current, * work, * next;
+    int index, rootid = 0; // rootid: reverse traversal index
+    if(kPageable && rnode != nullptr) leaf_num_.fetch_add(1, std::memory_order_relaxed);
     while(rnode != nullptr) { // correctly insert the key to leaf node, splitting
       rootid += 1; // to upper level
       if(current == root_) {
@@ -298,32 +617,26 @@ class alignas(64) FBTree {
         unlatch_exclusive(work);
         work = next;
       }
-      unlatch_exclusive(current);
+      if(!keep || current != bottom) unlatch_exclusive(current);
       // inner node insertion
       rnode = inner(work)->insert(current, rnode, mid, index);
       current = work;
+      if(kRootModel && rnode != nullptr) inner_splits_.fetch_add(1, std::memory_order_relaxed);
     }
 
-    unlatch_exclusive(current);
-    return old;
-  }
-
-  // kv should be allocated by malloc
-  template<typename Value>
-  KVPair* upsert(K key, const Value& value) {
-    void* kv = malloc(sizeof(KVPair));
-    new(kv) KVPair{key, value};
-    return upsert((KVPair*) kv);
+    if(!keep || current != bottom) unlatch_exclusive(current);
+    return rootid;
   }
 
-  template<typename Value>
-  KVPair* upsert(K key, Value&& value) {
-    void* kv = malloc(sizeof(KVPair));
-    new(kv) KVPair{key, std::move(value)};
-    return upsert((KVPair*) kv);
+  KVPair* remove(K key, bool merge_only, int merge_size) {
+    return remove(key, merge_only, merge_size, [](KVPair*) { return true; });
   }
 
-  KVPair* remove(K key) {
+  /* remove the key if pred(kv), or merge the leaf node of the key with its right
+   * sibling node if they hold at most merge_size keys (merge_only, used by
+   * maintenance and compaction), then update upper levels */
+  template<typename P>
+  KVPair* remove(K key, bool merge_only, int merge_size, P&& pred) {
     assert(epoch_->guarded());
     std::vector<void*> path_stack;
     path_stack.reserve(tree_depth_);
@@ -348,10 +661,20 @@ class alignas(64) FBTree {
 
     int index, rootid = 0;
     void* merged, * next;
-    KVPair* kv = leaf(current)->remove(key, merged, mid);
+    KVPair* kv = nullptr;
+    if(merge_only) leaf(current)->merge_sibling(merged, mid, merge_size);
+    else kv = leaf(current)->remove(key, merged, mid, maintaining_.load(std::memory_order_relaxed), pred);
+    if(kv != nullptr) record(current, nullptr, key, kv);
+    if(Config::kLeafClassOpt && current == root_) current = resize_root(current);
+    touch(current);
 
     bool up = false; // need to update upper level key
     while(merged || up) {
+      if(Config::kDeltaOpt && rootid == 0 && merged) // the merged leaf node
+        epoch_->retire(leaf(merged)->delta_buffer());
+      if(Config::kLeafDirectory && rootid == 0 && merged) directory_->invalidate();
+      if(kPageable && rootid == 0 && merged) leaf_num_.fetch_sub(1, std::memory_order_relaxed);
+      if(kRootModel && rootid > 0 && merged) inner_deletes_.fetch_add(1, std::memory_order_acq_rel);
       epoch_->retire(merged);
       rootid += 1;
 
@@ -380,6 +703,7 @@ class alignas(64) FBTree {
         next = inner(work)->root_remove();
         if(next) {
           root_ = next, tree_depth_--;
+          if(kRootModel) inner_deletes_.fetch_add(1, std::memory_order_acq_rel);
           epoch_->retire(work);
           assert(next == current);
         }
@@ -393,13 +717,292 @@ class alignas(64) FBTree {
     }
 
     unlatch_exclusive(current);
+    if(kRootModel && rootid > 1) model_build(false); // inner nodes were updated
     return kv;
   }
 
-  // kv should be allocated by malloc
-  // update can also be implemented through kv returned by lookup
-  KVPair* update(KVPair* kv) {
-    assert(epoch_->guarded());
+  /* replace the root leaf node (latched, the tree depth is 1) by a copy of the
+   * size class that fits its keys, return the latched copy or node itself */
+  void* resize_root(void* node) {
+    int size_class = leaf(node)->fit_class();
+    if(size_class == leaf(node)->size_class()) return node;
+    void* copy = malloc(LeafNode::node_size(size_class));
+    new(copy) LeafNode(size_class);
+    latch_exclusive(copy);
+    leaf(node)->resize(leaf(copy));
+    // node is latched, so no other threads can split it or modify root
+    root_track_[0] = copy;
+    root_ = copy;
+    unlatch_exclusive(node);
+    if(Config::kLeafDirectory) directory_->invalidate();
+    if(Config::kDeltaOpt) epoch_->retire(leaf(node)->delta_buffer());
+    epoch_->retire(node);
+    return copy;
+  }
+
+  // the inner node to start traversal for key predicted by the root model, or null
+  void* model_find(K key) {
+    if constexpr(kRootModel) {
+      RootModel<K>* model = model_.load(std::memory_order_acquire);
+      if(model != nullptr && model->gen() == inner_deletes_.load(std::memory_order_acquire))
+        return model->find(key);
+    }
+    return nullptr;
+  }
+
+  /* rebuild the root model if it is invalid (inner nodes were deleted) or out
+   * of date (split too many times), or force; one thread builds at a time, the
+   * nodes are collected top-down by optimistic reads, if inner nodes were deleted
+   * meanwhile, the model is built again, the old model is retired by epoch */
+  void model_build(bool force) {
+    if constexpr(kRootModel) {
+      auto stale = [this](RootModel<K>* model) {
+        if(model == nullptr) return tree_depth_ >= Config::kModelLevels + 2;
+        uint64_t splits = inner_splits_.load(std::memory_order_relaxed) - model->splits();
+        return model->gen() != inner_deletes_.load(std::memory_order_acquire)
+               || splits * Config::kModelRebuild >= (uint64_t) model->size();
+      };
+      if(!force && !stale(model_.load(std::memory_order_acquire))) return;
+      if(modeling_.exchange(true, std::memory_order_acquire)) return;
+
+      RootModel<K>* model = nullptr;
+      std::vector<std::pair<K, void*>> nodes, children;
+      while(true) {
+        uint64_t gen = inner_deletes_.load(std::memory_order_acquire);
+        uint64_t splits = inner_splits_.load(std::memory_order_relaxed);
+        bool valid = tree_depth_ >= Config::kModelLevels + 2;
+        nodes.assign(1, {K(), root_});
+        for(int lid = 0; valid && lid < Config::kModelLevels; lid++) {
+          children.clear();
+          for(auto& node : nodes) {
+            if(is_leaf(node.second) || !inner(node.second)->child_bounds(node.first, children)) {
+              valid = false; // the tree shrank or nodes were deleted
+              break;
+            }
+          }
+          std::swap(nodes, children);
+        }
+        for(auto& node : nodes) valid = valid && !is_leaf(node.second);
+        if(!valid) {
+          if(gen != inner_deletes_.load(std::memory_order_acquire)) continue;
+          break; // too low to skip levels
+        }
+        model = RootModel<K>::build(nodes, gen, splits);
+        if(gen == inner_deletes_.load(std::memory_order_acquire)) break;
+        free(model), model = nullptr; // some node may have been deleted
+      }
+
+      RootModel<K>* old = model_.exchange(model, std::memory_order_acq_rel);
+      if(old != nullptr) epoch_->retire(old);
+      modeling_.store(false, std::memory_order_release);
+    }
+  }
+
+  /* stamp a write of key to the latched leaf node (or to the new right node
+   * rnode holding key after a split), keeping old (null if the key was absent)
+   * for snapshots older than the write, see Snapshot */
+  void record(void* node, void* rnode, const K& key, KVPair* old) {
+    if constexpr(Config::kMvccOpt) {
+      uint64_t ts = versions_.tick();
+      record(node, rnode, key, old, ts, versions_.floor());
+    }
+  }
+
+  // see above, writes of a transaction share one timestamp, see Transaction::commit
+  void record(void* node, void* rnode, const K& key, KVPair* old, uint64_t ts, uint64_t floor) {
+    if constexpr(Config::kMvccOpt) {
+      if(rnode != nullptr && leaf(node)->high_key() < key) node = rnode;
+      leaf(node)->prune_undo(floor);
+      if(ts > floor) leaf(node)->push_undo(new Undo<K, V>(ts, key, old));
+    }
+  }
+
+  /* see Snapshot::scan, the walk is like write_delta, from the leaf node of the
+   * last high key again after each batch */
+  template<typename F>
+  void snapshot_scan(uint64_t ts, const K& start, const K& end, F& fn) {
+    constexpr int kBatch = 64; // leaf nodes per epoch guard
+    std::vector<KVPair*> kvs;
+    std::vector<std::pair<K, V>> batch;
+    bool has_low = false, done = false;
+    K low = start;
+    while(!done) {
+      batch.clear();
+      {
+        EpochGuard guard(*epoch_);
+        void* node = root_, * next;
+        K key = encode_convert(low);
+        while(!is_leaf(node)) inner(node)->to_next(key, node);
+        for(int n = 0; n < kBatch;) {
+          latch_exclusive(node);
+          if(leaf(node)->to_sibling(low, next)) { // deleted, or keys were moved right
+            unlatch_exclusive(node);
+            node = next;
+            continue;
+          }
+          kvs.clear();
+          leaf(node)->collect(kvs, has_low, low, ts);
+          bool has_high = control(node)->has_sibling();
+          K high = leaf(node)->high_key();
+          next = leaf(node)->sibling();
+          unlatch_exclusive(node);
+
+          // current kvs are retired by epoch, undo entries newer than ts are kept
+          std::sort(kvs.begin(), kvs.end(), [](KVPair* a, KVPair* b) { return a->key < b->key; });
+          for(KVPair* kv : kvs)
+            if(!(kv->key < start) && !(end < kv->key)) batch.emplace_back(kv->key, kv->value);
+          if(!has_high || !(high < end)) {
+            done = true;
+            break;
+          }
+          has_low = true, low = high;
+          node = next, n++;
+        }
+      }
+      for(auto& [key, value] : batch)
+        if(!fn(key, value)) return;
+    }
+  }
+
+  /* fn(key, value) for the keys in (low, high] (without a bound if has_low or
+   * has_high is false), see parallel_for_each; leaf nodes are walked like
+   * count_range, kvs of each are gathered optimistically in bitmap order, and
+   * the walk starts from the root again after each batch of leaf nodes */
+  template<typename F>
+  void range_visit(bool has_low, const K& low, bool has_high, const K& high, F& fn) {
+    constexpr int kBatch = 64; // leaf nodes per epoch guard
+    std::vector<KVPair*> kvs;
+    bool has_last = has_low, done = false;
+    K last = low;
+    while(!done) {
+      EpochGuard guard(*epoch_);
+      void* node = root_track_[0], * next; // the leftmost leaf node
+      if(has_last) {
+        K key = encode_convert(last);
+        node = root_;
+        while(!is_leaf(node)) inner(node)->to_next(key, node);
+      }
+      for(int n = 0; n < kBatch;) {
+        uint64_t version;
+        bool deleted, has_high_key;
+        K high_key;
+        do {
+          version = control(node)->begin_read();
+          deleted = control(node)->deleted(), has_high_key = control(node)->has_sibling();
+          high_key = leaf(node)->high_key(), next = leaf(node)->sibling();
+          kvs.clear();
+          if(!deleted) leaf(node)->visit([&](KVPair* kv) { kvs.push_back(kv); });
+        } while(!control(node)->end_read(version));
+
+        if(deleted) { // merged into its left node, whose keys above the last high key are visited
+          node = next;
+          continue;
+        }
+        // kvs are retired by epoch, so still readable
+        for(KVPair* kv : kvs)
+          if((!has_last || last < kv->key) && (!has_high || !(high < kv->key))) fn(kv->key, kv->value);
+        if(!has_high_key || (has_high && !(high_key < high))) {
+          done = true;
+          break;
+        }
+        has_last = true, last = high_key;
+        node = next, n++;
+      }
+    }
+  }
+
+  // current leaf node is modified, see checkpoint_incremental
+  void touch(void* node) {
+    if(Config::kDirtyOpt) leaf(node)->touch(ckpt_gen_.load(std::memory_order_relaxed));
+  }
+
+  // replace the kv pairs in the key range by those of range, see checkpoint_incremental
+  void replace_range(DeltaRange<K, V>& range) {
+    std::vector<K> stale;
+    auto kv = range.kvs_.begin();
+    iterator it = range.has_low_ ? upper_bound(range.low_) : begin();
+    for(; !it.end() && range.covers(it->key); it.advance()) {
+      while(kv != range.kvs_.end() && kv->first < it->key) ++kv;
+      if(kv == range.kvs_.end() || !(kv->first == it->key)) stale.push_back(it->key);
+    }
+    for(K& key : stale)
+      if(KVPair* old = remove(key)) epoch_->retire(old);
+    for(auto& [key, value] : range.kvs_)
+      if(KVPair* old = upsert(key, value)) epoch_->retire(old);
+  }
+
+  /* write the key ranges of the leaf nodes modified since the generation from,
+   * with all their kv pairs, to a delta file; leaf nodes are latched one at a
+   * time, a deleted (merged) leaf node moves back to its left node, whose keys
+   * beyond the last high key are written again */
+  bool write_delta(const char* path, uint64_t from) {
+    DeltaWriter<K, V> writer;
+    if(!writer.open(path)) return false;
+    std::vector<KVPair*> kvs;
+    bool has_low = false;
+    K low{};
+    void* node = root_track_[0];
+    while(node != nullptr) {
+      uint64_t version;
+      bool deleted, dirty, has_high;
+      K high;
+      void* next;
+      do { // clean leaf nodes are only read optimistically
+        version = control(node)->begin_read();
+        deleted = control(node)->deleted(), dirty = leaf(node)->stamp() >= from;
+        has_high = control(node)->has_sibling(), high = leaf(node)->high_key();
+        next = leaf(node)->sibling();
+      } while(!control(node)->end_read(version));
+      if(deleted) {
+        node = next;
+        continue;
+      }
+
+      if(dirty) {
+        latch_exclusive(node);
+        if(control(node)->deleted()) { // merged meanwhile, read it again
+          unlatch_exclusive(node);
+          continue;
+        }
+        kvs.clear();
+        leaf(node)->collect(kvs, has_low, low);
+        has_high = control(node)->has_sibling(), high = leaf(node)->high_key();
+        next = leaf(node)->sibling();
+        unlatch_exclusive(node);
+
+        // kvs are retired by epoch, so still readable
+        std::sort(kvs.begin(), kvs.end(), [](KVPair* a, KVPair* b) { return a->key < b->key; });
+        writer.append(has_low, low, has_high, high, kvs);
+      }
+      has_low = true, low = high;
+      node = next;
+    }
+    return writer.finish();
+  }
+
+  // latch the leaf node of key, moving right from node (a leaf node left of key)
+  void* latch_leaf(const K& key, void* node = nullptr) {
+    if(node == nullptr) {
+      K cvt_key = encode_convert(key);
+      node = root_;
+      while(!is_leaf(node)) {
+        inner(node)->to_next(cvt_key, node);
+        node_prefetch(node);
+      }
+    }
+
+    void* next;
+    latch_exclusive(node);
+    while(leaf(node)->to_sibling(key, next)) {
+      latch_exclusive(next);
+      unlatch_exclusive(node);
+      node = next;
+    }
+    return node;
+  }
+
+  // replace the kv of the key if it exists, see update
+  KVPair* update_run(KVPair* kv) {
     K key = encode_convert(kv->key);
     void* node = root_;
     while(!is_leaf(node)) {
@@ -407,17 +1010,895 @@ class alignas(64) FBTree {
       node_prefetch(node);
     }
 
+    if constexpr(Config::kMvccOpt) { // writes are stamped in the latch section
+      node = latch_leaf(kv->key, node);
+      leaf(node)->page_in(); // under the latch, a fault in update would latch it again
+      KVPair* old = leaf(node)->update(kv);
+      if(old != nullptr) {
+        record(node, nullptr, kv->key, old);
+        touch(node);
+      }
+      unlatch_exclusive(node);
+      return old;
+    }
+
     uint64_t version;
     do {
       version = control(node)->begin_read();
       while(leaf(node)->to_sibling(kv->key, node)) {
         version = control(node)->begin_read();
       }
-      KVPair* old = leaf(node)->update(kv);
-      if(old != nullptr) return old; // update succeeded
-    } while(!control(node)->end_read(version));
+      KVPair* old = leaf(node)->update(kv);
+      if(old != nullptr) { // update succeeded
+        touch(node);
+        return old;
+      }
+    } while(!control(node)->end_read(version));
+
+    return nullptr;  // the key doesn't exist
+  }
+
+  /* apply fn to the value of key in the latch section of its leaf node, return
+   * false if the key doesn't exist, value is the merged value; a kInPlace (integral)
+   * value is updated in place with compare-and-swap (a merge on the kv replaced by a
+   * concurrent lock-free update is ordered before the update), others are
+   * copied, merged and swapped in, and the old kv is retired by epoch */
+  template<typename F>
+  bool merge_value(const K& key, F& fn, V& value) {
+    void* node = latch_leaf(key);
+    std::atomic<KVPair*>* slot = leaf(node)->slot(key);
+    if(slot == nullptr) {
+      unlatch_exclusive(node);
+      return false;
+    }
+
+    if constexpr(kInPlace) {
+      V* target = &slot->load(std::memory_order_acquire)->value;
+      V old = __atomic_load_n(target, __ATOMIC_ACQUIRE);
+      do {
+        value = old;
+        fn(value);
+      } while(!__atomic_compare_exchange_n(target, &old, value, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+      // a Transaction validates a read by the version and the kv of the leaf node, and this
+      // changes neither kv; only reads overlapping the latch section retry for it
+      control(node)->update_version();
+    } else {
+      KVPair* old = slot->load(std::memory_order_acquire);
+      KVPair* kv = (KVPair*) malloc(sizeof(KVPair));
+      new(kv) KVPair{key, old->value};
+      fn(kv->value);
+      while(!slot->compare_exchange_weak(old, kv)) { // replaced by a lock-free update
+        kv->value = old->value;
+        fn(kv->value);
+      }
+      value = kv->value;
+      record(node, nullptr, key, old);
+      epoch_->retire(old);
+    }
+    touch(node);
+    unlatch_exclusive(node);
+    return true;
+  }
+
+  // see compare_exchange
+  KVPair* compare_exchange_run(KVPair* kv, const V& expected) {
+    void* node = latch_leaf(kv->key);
+    std::atomic<KVPair*>* slot = leaf(node)->slot(kv->key);
+    KVPair* old = slot == nullptr ? nullptr : slot->load(std::memory_order_acquire);
+    bool exchanged = false;
+    // merges are excluded by the latch, lock-free updates fail the exchange
+    while(old != nullptr && old->value == expected) {
+      if(slot->compare_exchange_weak(old, kv)) {
+        record(node, nullptr, kv->key, old);
+        touch(node);
+        exchanged = true;
+        break;
+      }
+    }
+    unlatch_exclusive(node);
+    return exchanged ? old : nullptr;
+  }
+
+  // see merge, insert fn(V()) if the key doesn't exist, return true if it existed
+  template<typename F>
+  bool merge_upsert(const K& key, F& fn, V& value) {
+    while(true) {
+      if(merge_value(key, fn, value)) return true;
+      KVPair* kv = (KVPair*) malloc(sizeof(KVPair));
+      new(kv) KVPair{key, V()};
+      fn(kv->value);
+      KVPair* old;
+      upsert_run(&kv, 1, &old, false);
+      if(old == nullptr) {
+        value = kv->value;
+        return false;
+      }
+      kv->~KVPair(); // inserted concurrently, merge into it
+      free(kv);
+    }
+  }
+
+  /* apply an upsert/update/remove, with the redo log (see open_log), its record
+   * is appended and applied in the stripe section of the key, then it waits
+   * until the record is durable */
+  template<typename F>
+  KVPair* logged(LogOp op, const K& key, const V* value, F&& apply) {
+    if constexpr(kLoggable) {
+      if(log_ != nullptr) {
+        uint64_t lsn;
+        KVPair* ret;
+        {
+          std::lock_guard<std::mutex> guard(log_->stripe(key));
+          lsn = log_->append(op, key, value);
+          ret = apply();
+        }
+        log_->commit(lsn);
+        return ret;
+      }
+    }
+    return apply();
+  }
+
+  /* see logged, for conditional operations: apply returns whether it took effect,
+   * and the record is appended only then */
+  template<typename F>
+  bool logged_if(LogOp op, const K& key, const V* value, F&& apply) {
+    if constexpr(kLoggable) {
+      if(log_ != nullptr) {
+        uint64_t lsn;
+        {
+          std::lock_guard<std::mutex> guard(log_->stripe(key));
+          if(!apply()) return false;
+          lsn = log_->append(op, key, value);
+        }
+        log_->commit(lsn);
+        return true;
+      }
+    }
+    return apply();
+  }
+
+  // merge right sibling nodes into the leaf node while underfull, return the number of merges
+  int merge_run(void* node, int merge_size) {
+    int merges = 0;
+    while(leaf(node)->underfull(merge_size)) {
+      void* sibling = leaf(node)->sibling();
+      remove(leaf(node)->high_key(), true, merge_size);
+      if(leaf(node)->sibling() == sibling) break; // stale high key, retry later
+      merges += 1;
+    }
+    return merges;
+  }
+
+ public:
+  FBTree() {
+    root_ = malloc(LeafNode::node_size(LeafNode::max_class()));
+    new(root_) LeafNode(LeafNode::max_class());
+    tree_depth_ = 1;
+    root_track_[0] = root_;
+    epoch_ = new Epoch();
+    maintaining_ = false;
+    directory_ = Config::kLeafDirectory ? new LeafDirectory<K>() : nullptr;
+    model_ = nullptr, inner_deletes_ = 0, inner_splits_ = 0, modeling_ = false;
+    log_ = nullptr, log_seq_ = 0;
+    ckpt_gen_ = 1, dirty_from_ = 0;
+    pager_ = nullptr, clock_hand_ = K(), clock_set_ = false, leaf_num_ = 1;
+  }
+
+  //By default, kv is destruct and then the memory block of kv is freed
+  ~FBTree() { // recursive destructor result in stackoverflow
+    stop_maintenance();
+    for(int rid = 0; rid < tree_depth_; rid++) {
+      void* node = root_track_[rid], * sibling;
+      while(node) {
+        if(is_leaf(node)) {
+          leaf(node)->~LeafNode();
+          sibling = leaf(node)->sibling();
+        } else {
+          inner(node)->~InnerNode();
+          sibling = inner(node)->sibling();
+        }
+        free(node);
+        node = sibling;
+      }
+    }
+    close_log();
+    delete pager_; // after leaf nodes release their pages
+    delete directory_;
+    free(model_.load());
+    delete epoch_;
+  }
+
+  void node_parameter() { Constant<K>::node_parameter(); }
+
+  void statistics() {
+    std::map<std::string, double> stat;
+    stat["index depth"] = tree_depth_;
+    for(int rid = 0; rid < tree_depth_; rid++) {
+      void* node = root_track_[rid];
+      while(node) {
+        if(is_leaf(node)) {
+          leaf(node)->statistic(stat);
+          node = leaf(node)->sibling();
+        } else {
+          inner(node)->statistic(stat);
+          node = inner(node)->sibling();
+        }
+      }
+    }
+    if(directory_ != nullptr) stat["index size"] += directory_->size();
+    if constexpr(kRootModel) {
+      RootModel<K>* model = model_.load();
+      if(model != nullptr) stat["model node num"] = model->size();
+    }
+    stat["load factor"] = stat["kv pair num"] / (stat["leaf num"] * Constant<K>::kLeafSize);
+
+    std::cout << "-- FBTree statistics" << std::endl;
+    for(auto item : stat) {
+      if(item.first == "index size") {
+        size_t GB = 1024ul * 1024 * 1024;
+        std::cout << "  -- " << item.first << ": " << item.second / GB << " GB" << std::endl;
+      } else {
+        std::cout << "  -- " << item.first << ": " << item.second << std::endl;
+      }
+    }
+  }
+
+  Epoch& get_epoch() { return *epoch_; }
+
+  /* pack leaf nodes to about target_fill (0.5 ~ 1.0) of capacity by merging
+   * runs of sibling leaf nodes in place, concurrently with other operations,
+   * readers of a merged node are redirected to its left node as usual, and
+   * merged nodes are retired by epoch; return the number of merged nodes */
+  int compact(double target_fill) {
+    assert(epoch_->guarded());
+    constexpr int kLeafSize = Constant<K>::kLeafSize;
+    int merge_size = std::max<int>(target_fill * kLeafSize, Constant<K>::kLeafMergeSize);
+    merge_size = std::min(merge_size, kLeafSize);
+
+    int merges = 0;
+    void* node = root_track_[0];
+    while(node != nullptr) {
+      merges += merge_run(node, merge_size);
+      node = leaf(node)->sibling();
+    }
+    return merges;
+  }
+
+  /* save kv pairs in key order to a snapshot file, see SnapshotHeader, the caller
+   * fills blocks, which nthreads writers take in order, checksum and write;
+   * keys and values are copied bytewise, and concurrent writes may be partially
+   * included (like a scan, each leaf node is read atomically); return false on io error */
+  bool save(const char* path, int nthreads = 1) {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>);
+    assert(epoch_->guarded());
+    constexpr size_t kRecord = sizeof(K) + sizeof(V);
+    constexpr size_t kBlock = Config::kSnapshotBlock * kRecord + sizeof(uint64_t);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return false;
+
+    SnapshotHeader header{kSnapshotMagic, sizeof(K), sizeof(V), Config::kSnapshotBlock, 0, 0};
+    nthreads = std::max(nthreads, 1);
+    std::vector<std::vector<char>> blocks(2 * nthreads); // block bid is filled in blocks[bid % size]
+    std::vector<bool> busy(blocks.size(), false);
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t filled = 0, taken = 0; // blocks filled by the caller, and taken by writers
+    bool finished = false;
+    std::atomic<bool> ok = true;
+    auto writer = [&]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      while(true) {
+        cv.wait(lock, [&]() { return taken < filled || finished; });
+        if(taken == filled) return; // finished
+        uint64_t bid = taken++;
+        lock.unlock();
+        std::vector<char>& block = blocks[bid % blocks.size()];
+        uint64_t sum = checksum(block.data(), block.size());
+        block.insert(block.end(), (char*) &sum, (char*) &sum + sizeof(uint64_t));
+        off_t offset = sizeof(SnapshotHeader) + bid * kBlock;
+        if(pwrite(fd, block.data(), block.size(), offset) != (ssize_t) block.size()) ok = false;
+        lock.lock();
+        busy[bid % blocks.size()] = false;
+        cv.notify_all();
+      }
+    };
+    std::vector<std::thread> writers;
+    for(int tid = 0; tid < nthreads; tid++) writers.emplace_back(writer);
+
+    iterator it = begin();
+    while(ok && !it.end()) {
+      std::vector<char>& block = blocks[filled % blocks.size()];
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return !busy[filled % blocks.size()]; });
+      }
+      block.clear();
+      for(int i = 0; i < Config::kSnapshotBlock && !it.end(); i++, it.advance()) {
+        block.insert(block.end(), (char*) &it->key, (char*) &it->key + sizeof(K));
+        block.insert(block.end(), (char*) &it->value, (char*) &it->value + sizeof(V));
+        header.count_ += 1;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      busy[filled % blocks.size()] = true;
+      filled += 1;
+      cv.notify_all();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished = true;
+      cv.notify_all();
+    }
+    for(auto& thread : writers) thread.join();
+
+    header.checksum_ = checksum(&header, offsetof(SnapshotHeader, checksum_));
+    if(pwrite(fd, &header, sizeof(SnapshotHeader), 0) != (ssize_t) sizeof(SnapshotHeader)) ok = false;
+    if(fsync(fd) != 0) ok = false;
+    close(fd);
+    return ok;
+  }
+
+  /* load kv pairs from a snapshot file written by save, blocks are read, verified
+   * and upserted as sorted batches by nthreads loaders in parallel (in their own
+   * epoch guards, so it is called outside the epoch guard); return false if the
+   * file can't be read or is corrupted, then kv pairs of verified blocks stay */
+  bool load(const char* path, int nthreads = 1) {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>);
+    constexpr size_t kRecord = sizeof(K) + sizeof(V);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+
+    SnapshotHeader header;
+    if(pread(fd, &header, sizeof(SnapshotHeader), 0) != (ssize_t) sizeof(SnapshotHeader)
+       || header.checksum_ != checksum(&header, offsetof(SnapshotHeader, checksum_))
+       || header.magic_ != kSnapshotMagic || header.key_size_ != sizeof(K)
+       || header.value_size_ != sizeof(V) || header.block_size_ == 0) {
+      close(fd);
+      return false;
+    }
+
+    const size_t block_bytes = header.block_size_ * kRecord + sizeof(uint64_t);
+    const uint64_t nblock = (header.count_ + header.block_size_ - 1) / header.block_size_;
+    std::atomic<uint64_t> next = 0; // the next block to load
+    std::atomic<bool> ok = true;
+    auto loader = [&]() {
+      std::vector<char> block(block_bytes);
+      std::vector<KVPair*> kvs(header.block_size_), olds(header.block_size_);
+      for(uint64_t bid; ok && (bid = next.fetch_add(1)) < nblock;) {
+        int n = std::min<uint64_t>(header.block_size_, header.count_ - bid * header.block_size_);
+        size_t size = n * kRecord;
+        uint64_t sum = 0;
+        off_t offset = sizeof(SnapshotHeader) + bid * block_bytes;
+        if(pread(fd, block.data(), size + sizeof(uint64_t), offset) == (ssize_t) (size + sizeof(uint64_t)))
+          memcpy(&sum, block.data() + size, sizeof(uint64_t));
+        if(sum != checksum(block.data(), size)) {
+          ok = false; // a short read or a corrupted block
+          break;
+        }
+
+        for(int i = 0; i < n; i++) {
+          K key;
+          V value;
+          memcpy(&key, block.data() + i * kRecord, sizeof(K));
+          memcpy(&value, block.data() + i * kRecord + sizeof(K), sizeof(V));
+          kvs[i] = (KVPair*) malloc(sizeof(KVPair));
+          new(kvs[i]) KVPair{key, value};
+        }
+        EpochGuard guard(*epoch_);
+        upsert_batch(kvs.data(), n, olds.data());
+        for(int i = 0; i < n; i++)
+          if(olds[i] != nullptr) epoch_->retire(olds[i]);
+      }
+    };
+
+    std::vector<std::thread> loaders;
+    for(int tid = 1; tid < nthreads; tid++) loaders.emplace_back(loader);
+    loader();
+    for(auto& thread : loaders) thread.join();
+    close(fd);
+    return ok;
+  }
+
+  /* recover the (empty) tree from the snapshot at snapshot_path (if any) and the
+   * segments of the redo log at log_path, then log upsert/update/remove to a new
+   * segment, each returns once its record is durable (group commit, see RedoLog);
+   * upsert_batch and appenders are not logged; it is called outside the epoch
+   * guard and not concurrently with other operations; return false on error */
+  bool open_log(const char* log_path, const char* snapshot_path = nullptr) {
+    static_assert(kLoggable, "keys and values are logged bytewise");
+    if(log_ != nullptr) return false;
+    if(snapshot_path != nullptr && access(snapshot_path, F_OK) == 0 && !load(snapshot_path))
+      return false;
+
+    std::vector<uint64_t> segments = RedoLog<K, V>::segments(log_path);
+    {
+      EpochGuard guard(*epoch_);
+      // deltas of incremental checkpoints, in order
+      for(uint64_t seq : snapshot_path ? numbered_files(snapshot_path) : std::vector<uint64_t>()) {
+        auto replace = [this](DeltaRange<K, V>& range) { replace_range(range); };
+        if(!read_delta<K, V>(numbered_file(snapshot_path, seq).c_str(), replace)) return false;
+      }
+      dirty_from_ = ckpt_gen_.fetch_add(1) + 1; // the recovered checkpoint is clean
+
+      auto apply = [this](LogOp op, const K& key, const V* value) {
+        KVPair* old = nullptr;
+        if(op == kLogUpsert) old = upsert(key, *value);
+        else if(op == kLogUpdate) old = update(key, *value);
+        else if(op == kLogRemove) old = remove(key);
+        if(old != nullptr) epoch_->retire(old);
+      };
+      // replaying records already in the snapshot is harmless, the last record of a key wins
+      for(uint64_t seq : segments) RedoLog<K, V>::replay(RedoLog<K, V>::segment(log_path, seq), apply);
+    }
+
+    log_path_ = log_path;
+    log_seq_ = segments.empty() ? 0 : segments.back() + 1; // never append to a torn segment
+    log_ = RedoLog<K, V>::open(RedoLog<K, V>::segment(log_path_, log_seq_));
+    return log_ != nullptr;
+  }
+
+  /* save a snapshot to snapshot_path (see save) and drop the log segments it
+   * covers: the log first switches to a new segment, then the snapshot is saved
+   * to a temporary file and renamed, so a crash at any point leaves a snapshot
+   * plus the segments written after it was started */
+  bool checkpoint(const char* snapshot_path, int nthreads = 1) {
+    assert(epoch_->guarded());
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    if(log_ == nullptr) return false;
+    uint64_t seq = log_seq_;
+    if(!log_->rotate(RedoLog<K, V>::segment(log_path_, seq + 1))) return false;
+    log_seq_ = seq + 1;
+    uint64_t from = dirty_from_;
+    dirty_from_ = ckpt_gen_.fetch_add(1);
+
+    std::string temp = std::string(snapshot_path) + ".tmp";
+    if(!save(temp.c_str(), nthreads) || rename(temp.c_str(), snapshot_path) != 0) {
+      dirty_from_ = from; // the next checkpoint covers the modifications since from
+      return false;
+    }
+    // the deltas before the segments, reapplying deltas to the new snapshot is undone by the log
+    for(uint64_t old : numbered_files(snapshot_path)) unlink(numbered_file(snapshot_path, old).c_str());
+    for(uint64_t old : RedoLog<K, V>::segments(log_path_))
+      if(old <= seq) unlink(RedoLog<K, V>::segment(log_path_, old).c_str());
+    log_->checkpointed();
+    return true;
+  }
+
+  /* like checkpoint, but only write the key ranges of leaf nodes modified since
+   * the last checkpoint, with all their kv pairs, to a delta file <snapshot_path>.<seq>
+   * (see DeltaRange), which is applied on top of the snapshot at recovery; the
+   * dirty leaf nodes are tracked if Config::kDirtyOpt, otherwise all are written;
+   * the first checkpoint is a full one */
+  bool checkpoint_incremental(const char* snapshot_path) {
+    assert(epoch_->guarded());
+    if(access(snapshot_path, F_OK) != 0) return checkpoint(snapshot_path);
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    if(log_ == nullptr) return false;
+    uint64_t seq = log_seq_;
+    if(!log_->rotate(RedoLog<K, V>::segment(log_path_, seq + 1))) return false;
+    log_seq_ = seq + 1;
+    uint64_t from = dirty_from_;
+    dirty_from_ = ckpt_gen_.fetch_add(1);
+
+    std::vector<uint64_t> deltas = numbered_files(snapshot_path);
+    std::string path = numbered_file(snapshot_path, deltas.empty() ? 0 : deltas.back() + 1);
+    std::string temp = path + ".tmp";
+    if(!write_delta(temp.c_str(), from) || rename(temp.c_str(), path.c_str()) != 0) {
+      dirty_from_ = from;
+      return false;
+    }
+    for(uint64_t old : RedoLog<K, V>::segments(log_path_))
+      if(old <= seq) unlink(RedoLog<K, V>::segment(log_path_, old).c_str());
+    log_->checkpointed();
+    return true;
+  }
+
+  /* fold the deltas of incremental checkpoints into the snapshot at snapshot_path,
+   * streaming the snapshot once, see fold_deltas; concurrent with other operations */
+  bool compact_checkpoint(const char* snapshot_path) {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    return fold_deltas<K, V>(snapshot_path);
+  }
+
+  /* some logged operations since the last checkpoint are applied to the tree but
+   * failed to be written to the log (e.g., ENOSPC or EIO), they would be lost
+   * by a crash; a successful checkpoint makes them durable and clears it */
+  bool log_failed() {
+    if constexpr(kLoggable) return log_ != nullptr && log_->failed();
+    else return false;
+  }
+
+  /* stop logging, not concurrently with other operations, return false if
+   * some records failed to be written */
+  bool close_log() {
+    if constexpr(kLoggable) {
+      if(log_ == nullptr) return true;
+      bool ok = log_->sync();
+      delete log_;
+      log_ = nullptr;
+      return ok;
+    }
+    return true;
+  }
+
+  /* start a thread which maintains the tree structure every interval, see
+   * maintain(), meanwhile remove no longer merges leaf nodes inline */
+  void start_maintenance(std::chrono::milliseconds interval = std::chrono::milliseconds(100)) {
+    if(maintaining_.exchange(true)) return; // already started
+    maintainer_ = std::thread([this, interval]() {
+      std::unique_lock<std::mutex> lock(maintain_mutex_);
+      while(maintaining_.load()) {
+        lock.unlock();
+        {
+          EpochGuard guard(*epoch_); // not held while sleeping, so retired memory is reclaimed
+          maintain();
+        }
+        lock.lock();
+        maintain_cv_.wait_for(lock, interval, [this]() { return !maintaining_.load(); });
+      }
+    });
+  }
+
+  void stop_maintenance() {
+    {
+      std::lock_guard<std::mutex> lock(maintain_mutex_);
+      if(!maintaining_.exchange(false)) return;
+    }
+    maintain_cv_.notify_all();
+    maintainer_.join();
+  }
+
+  /* one pass of structural maintenance along the leaf chain: merge underfull
+   * sibling leaf nodes (and upper levels), sort unordered leaf nodes before
+   * scans need them, then rebuild the root model if it is stale (see
+   * Config::kRootModel); used by the maintenance thread, can also be
+   * called directly in the epoch guard, e.g., after a large delete */
+  void maintain() {
+    assert(epoch_->guarded());
+    void* node = root_track_[0]; // the leftmost leaf node, only resize_root replaces it
+    while(node != nullptr) {
+      merge_run(node, Constant<K>::kLeafMergeSize);
+
+      if(!control(node)->ordered()) {
+        latch_exclusive(node);
+        if(!control(node)->deleted()) leaf(node)->kv_sort();
+        unlatch_exclusive(node);
+      }
+      if(leaf(node)->has_undo()) { // drop undo entries no snapshot needs
+        latch_exclusive(node);
+        leaf(node)->prune_undo(versions_.floor());
+        unlatch_exclusive(node);
+      }
+      if(Config::kDeltaOpt && control(node)->heat() > 0) { // contention decays
+        latch_exclusive(node);
+        if(!control(node)->deleted())
+          if(void* delta = leaf(node)->cool_down()) epoch_->retire(delta);
+        unlatch_exclusive(node);
+      }
+      node = leaf(node)->sibling();
+    }
+    model_build(false);
+    if(pager_ != nullptr) evict(Config::kResidentLeaves);
+  }
+
+  /* page kv pairs of cold leaf nodes out to a scratch file at path (truncated,
+   * and unlinked once opened), see Config::kPagingOpt and evict; called before
+   * concurrent operations, return false if the file can't be created */
+  bool open_pager(const char* path) {
+    static_assert(kPageable, "paging needs Config::kPagingOpt and bytewise keys and values");
+    if(pager_ != nullptr) return false;
+    pager_ = Pager<K, V>::open(path);
+    return pager_ != nullptr;
+  }
+
+  /* one clock sweep along the leaf chain from where the last sweep stopped: a
+   * leaf node accessed since the last sweep gets a second chance, the others are
+   * paged out until at most resident leaf nodes hold kv pairs in memory; the
+   * released kvs are retired by epoch; return the number of leaf nodes paged out */
+  int evict(size_t resident) {
+    assert(epoch_->guarded());
+    if constexpr(kPageable) {
+      if(pager_ == nullptr) return 0;
+      std::lock_guard<std::mutex> lock(clock_mutex_);
+      // paged leaf nodes hold one page each, a racing split or fault only skews the counts a little
+      size_t nleaf = leaf_num_.load(std::memory_order_relaxed), npage = pager_->size();
+      size_t nresident = nleaf > npage ? nleaf - npage : 0;
+      if(nresident <= resident) return 0;
+
+      void* node = root_;
+      if(clock_set_) { // resume after the leaf node last swept
+        while(!is_leaf(node)) inner(node)->to_next(encode_convert(clock_hand_), node);
+        while(leaf(node)->to_sibling(clock_hand_, node));
+        node = leaf(node)->sibling();
+      } else { node = root_track_[0]; }
+
+      // two rounds at most, the first one clears referenced bits
+      int evicted = 0;
+      std::vector<KVPair*> retired;
+      for(size_t step = 0; step < 2 * nleaf && nresident > resident; step++) {
+        if(node == nullptr) node = root_track_[0]; // wrap around
+        if(!leaf(node)->paged() && !leaf(node)->unreference()) {
+          latch_exclusive(node);
+          if(!control(node)->deleted() && leaf(node)->page_out(pager_, retired)) {
+            nresident -= 1, evicted += 1;
+          }
+          unlatch_exclusive(node);
+        }
+        clock_hand_ = leaf(node)->high_key();
+        clock_set_ = control(node)->has_sibling();
+        node = leaf(node)->sibling();
+      }
+      for(KVPair* kv : retired) epoch_->retire(kv);
+      return evicted;
+    } else { return 0; }
+  }
+
+  // kv should be allocated by malloc
+  KVPair* upsert(KVPair* kv) {
+    assert(epoch_->guarded());
+    return logged(kLogUpsert, kv->key, &kv->value, [&]() {
+      KVPair* old;
+      upsert_run(&kv, 1, &old);
+      return old;
+    });
+  }
+
+  /* kvs should be allocated by malloc and sorted by key, a run of kvs falling
+   * into the same leaf node is upserted with one latch section, which suits
+   * (near-)monotonic keys, olds[i] is the old kv of kvs[i] (or nullptr) */
+  void upsert_batch(KVPair** kvs, int n, KVPair** olds) {
+    assert(epoch_->guarded());
+    for(int i = 1; i < n; i++)
+      DEBUG_COND_ERROR(kvs[i]->key < kvs[i - 1]->key, "upsert_batch error: unsorted kvs");
+    for(int i = 0; i < n;)
+      i += upsert_run(kvs + i, n - i, olds + i);
+  }
+
+
+  // kv should be allocated by malloc
+  template<typename Value>
+  KVPair* upsert(K key, const Value& value) {
+    void* kv = malloc(sizeof(KVPair));
+    new(kv) KVPair{key, value};
+    return upsert((KVPair*) kv);
+  }
+
+  template<typename Value>
+  KVPair* upsert(K key, Value&& value) {
+    void* kv = malloc(sizeof(KVPair));
+    new(kv) KVPair{key, std::move(value)};
+    return upsert((KVPair*) kv);
+  }
+
+  KVPair* remove(K key) {
+    return logged(kLogRemove, key, nullptr, [&]() { return remove(key, false, 0); });
+  }
+
+  /* read-modify-write: fn(V&) modifies the value of key in place, without a new
+   * kv pair for integral values (fn may be called more than once, on a fresh
+   * copy each time), or is applied to V() which is then inserted if the key
+   * doesn't exist; return true if the key existed; kvs returned by lookup
+   * may observe the value being merged */
+  template<typename F>
+  bool merge(K key, F&& fn) {
+    assert(epoch_->guarded());
+    V value;
+    if constexpr(kLoggable) {
+      if(log_ != nullptr) { // the merged value is logged as an upsert
+        uint64_t lsn;
+        bool existed;
+        {
+          std::lock_guard<std::mutex> guard(log_->stripe(key));
+          existed = merge_upsert(key, fn, value);
+          lsn = log_->append(kLogUpsert, key, &value);
+        }
+        log_->commit(lsn);
+        return existed;
+      }
+    }
+    return merge_upsert(key, fn, value);
+  }
+
+  /* insert kv only if the key doesn't exist, return nullptr if inserted, or the
+   * existing kv (kv is not linked then), kv should be allocated by malloc */
+  KVPair* insert_if_absent(KVPair* kv) {
+    assert(epoch_->guarded());
+    KVPair* old;
+    logged_if(kLogUpsert, kv->key, &kv->value, [&]() {
+      upsert_run(&kv, 1, &old, false);
+      return old == nullptr;
+    });
+    return old;
+  }
+
+  template<typename Value>
+  KVPair* insert_if_absent(K key, const Value& value) {
+    KVPair* kv = (KVPair*) malloc(sizeof(KVPair));
+    new(kv) KVPair{key, value};
+    KVPair* ret = insert_if_absent(kv);
+    if(ret != nullptr) kv->~KVPair(), free(kv);
+    return ret;
+  }
+
+  template<typename Value>
+  KVPair* insert_if_absent(K key, Value&& value) {
+    KVPair* kv = (KVPair*) malloc(sizeof(KVPair));
+    new(kv) KVPair{key, std::move(value)};
+    KVPair* ret = insert_if_absent(kv);
+    if(ret != nullptr) kv->~KVPair(), free(kv);
+    return ret;
+  }
+
+  /* replace the value of key by desired if it equals expected, decided in the
+   * latch section of its leaf node, return the replaced kv (or nullptr if the
+   * key doesn't exist or its value differs) */
+  KVPair* compare_exchange(K key, const V& expected, const V& desired) {
+    assert(epoch_->guarded());
+    KVPair* kv = (KVPair*) malloc(sizeof(KVPair));
+    new(kv) KVPair{key, desired};
+    KVPair* old;
+    logged_if(kLogUpdate, key, &kv->value, [&]() {
+      old = compare_exchange_run(kv, expected);
+      return old != nullptr;
+    });
+    if(old == nullptr) kv->~KVPair(), free(kv);
+    return old;
+  }
+
+  /* remove the key if pred(const V&) holds for its value, decided in the latch
+   * section of its leaf node (pred may be called again if a concurrent update
+   * replaces the kv), return the removed kv (or nullptr) */
+  template<typename P>
+  KVPair* remove_if(K key, P&& pred) {
+    assert(epoch_->guarded());
+    KVPair* old;
+    logged_if(kLogRemove, key, nullptr, [&]() {
+      old = remove(key, false, 0, [&](KVPair* kv) { return pred((const V&) kv->value); });
+      return old != nullptr;
+    });
+    return old;
+  }
+
+  /* the number of keys in [low, high), leaf nodes inside the range are counted
+   * by their bitmaps, only the two border ones compare keys; each leaf node is
+   * read optimistically, so it is exact without concurrent writes; like
+   * write_delta, keys not greater than the high key of the last counted leaf
+   * node are skipped, so splits and merges never count a key twice */
+  size_t count_range(K low, K high) {
+    assert(epoch_->guarded());
+    if(!(low < high)) return 0;
+    K cvt_key = encode_convert(low);
+    void* node = root_;
+    while(!is_leaf(node)) inner(node)->to_next(cvt_key, node);
+
+    size_t count = 0;
+    bool has_last = false, whole = false; // whole: all keys of node are above the last high key
+    K last{};
+    auto in = [&](const K& key) { return (has_last ? last < key : !(key < low)) && key < high; };
+    while(true) {
+      uint64_t version;
+      bool deleted, has_high;
+      K high_key;
+      void* next;
+      int n;
+      do {
+        version = control(node)->begin_read();
+        deleted = control(node)->deleted(), has_high = control(node)->has_sibling();
+        high_key = leaf(node)->high_key(), next = leaf(node)->sibling();
+        if(deleted) n = 0;
+        else if(whole && has_high && high_key < high) n = leaf(node)->size();
+        else n = leaf(node)->count(in);
+      } while(!control(node)->end_read(version));
+
+      if(deleted) { // merged into its left node, whose keys above the last high key are counted
+        node = next, whole = false;
+        continue;
+      }
+      count += n;
+      if(!has_high || !(high_key < high)) break;
+      has_last = true, last = high_key, whole = true;
+      node = next;
+    }
+    return count;
+  }
+
+  /* estimate the number of keys in [low, high) in O(height): descend to both
+   * borders, count the keys of the two border leaf nodes, and take each whole
+   * subtree between the two paths as the average fanout of the path nodes below
+   * it times the average size of the border leaf nodes */
+  size_t estimate_range(K low, K high) {
+    assert(epoch_->guarded());
+    if(!(low < high)) return 0;
+    struct Level {
+      int gap;       // whole subtrees between the two paths
+      double fanout; // average fanout of the two path nodes
+    } levels[kMaxHeight];
+    K cvt_low = encode_convert(low), cvt_high = encode_convert(high);
+    void* left = root_, * right = root_, * lnext, * rnext;
+    bool diverged = false;
+    int depth = 0;
+    while(!is_leaf(left) && depth < kMaxHeight) {
+      while(inner(left)->to_next(cvt_low, lnext)) left = lnext;
+      while(inner(right)->to_next(cvt_high, rnext)) right = rnext;
+      int lfan, rfan;
+      int lpos = inner(left)->position(lnext, lfan), rpos = inner(right)->position(rnext, rfan);
+      int gap = 0;
+      if(diverged || left != right) gap = lfan - lpos - 1 + rpos;
+      else if(lnext != rnext) gap = rpos - lpos - 1;
+      diverged |= lnext != rnext;
+      levels[depth++] = Level{std::max(gap, 0), (lfan + rfan) / 2.0};
+      left = lnext, right = rnext;
+    }
+
+    uint64_t version;
+    int lnum, rnum, lsize, rsize;
+    do {
+      version = control(left)->begin_read();
+      if(left == right) lnum = leaf(left)->count([&](const K& key) { return !(key < low) && key < high; });
+      else lnum = leaf(left)->count([&](const K& key) { return !(key < low); });
+      lsize = leaf(left)->size();
+    } while(!control(left)->end_read(version));
+    if(left == right) return lnum;
+    do {
+      version = control(right)->begin_read();
+      rnum = leaf(right)->count([&](const K& key) { return key < high; });
+      rsize = leaf(right)->size();
+    } while(!control(right)->end_read(version));
+
+    double estimate = lnum + rnum, subtree = (lsize + rsize) / 2.0;
+    for(int i = depth - 1; i >= 0; i--) {
+      estimate += levels[i].gap * subtree;
+      subtree *= levels[i].fanout;
+    }
+    return (size_t) (estimate + 0.5);
+  }
+
+  /* fn(key, value) for all kv pairs, unordered and concurrently by nthreads
+   * threads (fn must be thread-safe, and runs inside the epoch guards of the
+   * workers, so parallel_for_each itself must be called outside an epoch
+   * guard); the key space is split at the lower bounds
+   * of the children of inner nodes, at the highest level giving enough ranges
+   * (kPartitions per thread), threads take ranges from a shared counter and walk
+   * their leaf nodes without latches or sorting, validated by node versions;
+   * each kv pair present during the whole scan is visited exactly once */
+  template<typename F>
+  void parallel_for_each(F&& fn, int nthreads = 1) {
+    constexpr int kPartitions = 8;
+    nthreads = std::max(nthreads, 1);
+    std::vector<K> bounds; // ranges (bounds[i - 1], bounds[i]]
+    {
+      EpochGuard guard(*epoch_);
+      std::vector<std::pair<K, void*>> nodes{{K(), root_}}, children;
+      while(nodes.size() < (size_t) nthreads * kPartitions && !is_leaf(nodes[0].second)) {
+        children.clear();
+        bool valid = true;
+        for(auto& node : nodes)
+          valid = valid && !is_leaf(node.second) && inner(node.second)->child_bounds(node.first, children);
+        if(!valid) break; // the tree changed, the current level still splits the key space
+        std::swap(nodes, children);
+      }
+      for(size_t i = 1; i < nodes.size(); i++) // nodes are read at different times, like RootModel::build
+        if(bounds.empty() || bounds.back() < nodes[i].first) bounds.push_back(nodes[i].first);
+    }
+
+    std::atomic<size_t> next = 0; // the next range to visit
+    auto visitor = [&]() {
+      for(size_t rid; (rid = next.fetch_add(1)) <= bounds.size();) {
+        bool has_low = rid > 0, has_high = rid < bounds.size();
+        range_visit(has_low, has_low ? bounds[rid - 1] : K(), has_high, has_high ? bounds[rid] : K(), fn);
+      }
+    };
+    std::vector<std::thread> visitors;
+    for(int tid = 1; tid < nthreads; tid++) visitors.emplace_back(visitor);
+    visitor();
+    for(auto& thread : visitors) thread.join();
+  }
 
-    return nullptr;  // the key doesn't exist
+  // kv should be allocated by malloc
+  // update can also be implemented through kv returned by lookup
+  KVPair* update(KVPair* kv) {
+    assert(epoch_->guarded());
+    return logged(kLogUpdate, kv->key, &kv->value, [&]() { return update_run(kv); });
   }
 
   template<typename Value>
@@ -440,36 +1921,63 @@ class alignas(64) FBTree {
 
   KVPair* lookup(K key) {
     assert(epoch_->guarded());
-    K cvt_key = encode_convert(key);
-    void* node = root_;
-    while(!is_leaf(node)) {
-      inner(node)->to_next(cvt_key, node);
-      node_prefetch(node);
+    uint64_t gen = 0;
+    void* node = nullptr;
+    if(Config::kLeafDirectory) node = directory_->find(key, gen);
+    bool hit = node != nullptr; // start from the leaf node of the directory
+
+    if(!hit) {
+      K cvt_key = encode_convert(key);
+      if(kRootModel) node = model_find(key); // skip the top levels
+      if(node == nullptr) node = root_;
+      while(!is_leaf(node)) {
+        inner(node)->to_next(cvt_key, node);
+        node_prefetch(node);
+      }
     }
 
     uint64_t version;
     KVPair* kv;
+    int hops = 0;
     do {
       version = control(node)->begin_read();
       while(leaf(node)->to_sibling(key, node)) {
         version = control(node)->begin_read();
+        hops += 1;
       }
       kv = leaf(node)->lookup(key);
-      if(kv != nullptr) return kv; // find it
+      if(kv != nullptr) break; // find it
     } while(!control(node)->end_read(version));
 
-    return nullptr; // the key doesn't exist
+    // a prefix may span two leaf nodes, more hops mean the entry is out of date
+    if(Config::kLeafDirectory && (!hit || hops > 1))
+      directory_->record(key, node, gen, hit);
+    return kv; // null if the key doesn't exist
   }
 
   iterator begin() {
     assert(epoch_->guarded());
     LeafNode* node = leaf(root_track_[0]);
     assert(node != nullptr);
-    iterator it(node, 0, nullptr, 0);
-    it.version_ = control(node)->begin_read();
-    std::tie(it.kv_, it.pos_, it.version_) =
-      node->access(nullptr, 0, it.version_);
-    return it;
+    uint64_t version;
+    KVPair* kv = nullptr;
+    int pos = 0;
+    while(true) {
+      node->fault_in(); // before the read section, see LeafNode::access
+      version = control(node)->begin_read();
+      if(!control(node)->deleted()) {
+        std::tie(kv, pos, version) = node->access(nullptr, 0, version);
+        if(kv != nullptr) break;
+      }
+
+      // an empty node left by a lazy removal or a deferred merge, or a deleted node
+      // (the root leaf node replaced by resize_root), go on to its sibling
+      LeafNode* next = (LeafNode*) (node->sibling());
+      if(!control(node)->end_read(version)) continue; // filled or split meanwhile, retry
+      if(next == nullptr) break; // the tree is empty
+      node = next;
+    }
+    return iterator(node, version, kv, pos);
   }
 
   iterator lower_bound(K key) {
@@ -486,13 +1994,17 @@ class alignas(64) FBTree<String, V> {
   typedef FeatureBTree::LeafNode<String, V> LeafNode;
   typedef FeatureBTree::InnerNode<String> InnerNode;
   static constexpr int kMaxHeight = 13;
-  static constexpr int kBufSize = 256 - sizeof(String);
 
   void* root_;                  // root node
   int tree_depth_;              // tree depth/height
   Epoch* epoch_;                // epoch-based memory reclaimer
   void* root_track_[kMaxHeight];// track the root node
 
+  std::thread maintainer_;        // maintenance thread, see start_maintenance
+  std::atomic<bool> maintaining_; // merges are deferred to the maintenance thread
+  std::mutex maintain_mutex_;
+  std::condition_variable maintain_cv_;
+
  public:
   typedef util::KVPair<String, V> KVPair;
 
@@ -502,6 +2014,8 @@ class alignas(64) FBTree<String, V> {
     KVPair* kv_;       // the kv pointed by current iterator, null means the end
     int pos_;          // the ordinal of kv in current node (ordered view)
 
+    friend class FBTree;
+
    public:
     iterator() : node_(nullptr), kv_(nullptr) {}
 
@@ -534,7 +2048,10 @@ class alignas(64) FBTree<String, V> {
         version = ((Control*) node)->begin_read();
         std::tie(next, pos, version) = node->access(nullptr, 0, version);
         // left node in a consistent state, succeed to get next kv
-        if(((Control*) node_)->end_read(version_)) break;
+        if(((Control*) node_)->end_read(version_)) {
+          if(next != nullptr) break;
+          continue; // an empty node left by a deferred merge, go on to its sibling
+        }
 
         // enforce using bound to get next kv
         std::tie(next, pos, version) = node->access(kv_, 0, 0);
@@ -575,7 +2092,7 @@ class alignas(64) FBTree<String, V> {
     }
   }
 
-  iterator bound(String& key, bool upper) {
+  iterator bound(std::string_view key, bool upper) {
     // true for upper_bound, false for lower_bound
     assert(epoch_->guarded());
     void* node = root_;
@@ -636,17 +2153,147 @@ class alignas(64) FBTree<String, V> {
     return iterator((LeafNode*) node, version, kv, pos);
   }
 
+  /* remove the key, or merge the leaf node of the key with its right sibling
+   * node if they hold at most merge_size keys (merge_only, used by maintenance
+   * and compaction), then update upper levels */
+  KVPair* remove(std::string_view key, bool merge_only, int merge_size) {
+    assert(epoch_->guarded());
+    std::vector<void*> path_stack;
+    path_stack.reserve(tree_depth_);
+
+    //traverse the btree to leaf node, save path to path stack
+    void* work, * current = root_;
+    Control* parent = control(current); // the parent of leaf nodes
+    uint64_t version = 0; // version of leaf node's parent; init with zero,
+    // so an extreme case can perform correctly (no inner node here initially);
+    // used to determine whether we need to move to sibling in leaf node
+
+    while(!is_leaf(current)) {
+      work = current, parent = control(current);
+      if(!inner(work)->to_next(key, current, version)) {
+        path_stack.push_back(work);
+      } // move to a child or a sibling
+      node_prefetch(current);
+    }
+
+    // reach leaf node
+    latch_exclusive(current);
+    while(leaf(current)->to_sibling(key, work, parent, version)) {
+      assert(work != nullptr);
+      latch_exclusive(work);
+      unlatch_exclusive(current);
+      current = work;
+    }
+
+    int index, rootid = 0;
+    void* merged, * next;
+    String* mid;
+    KVPair* kv = nullptr;
+    if(merge_only) leaf(current)->merge_sibling(merged, mid, merge_size);
+    else kv = leaf(current)->remove(key, merged, mid, maintaining_.load(std::memory_order_relaxed));
+    if(Config::kLeafClassOpt && current == root_) current = resize_root(current);
+    if(merged) epoch_->retire(mid); // anchor keys are only store in leaf nodes
+
+    bool up = false; // need to update upper level key
+    while(merged || up) {
+      epoch_->retire(merged);
+      rootid += 1;
+
+      if(!path_stack.empty()) {
+        work = path_stack.back();
+        path_stack.pop_back();
+      } else {
+        work = root_track_[rootid];
+      }
+      assert(work != nullptr);
+
+      latch_exclusive(work);
+      while(inner(work)->index_or_sibling(*mid, next, index)) {
+        assert(next != nullptr);
+        latch_exclusive(next);
+        unlatch_exclusive(work);
+        work = next;
+      }
+      if(work != root_) unlatch_exclusive(current);
+
+      if(merged) merged = inner(work)->remove(mid, up, index, epoch_);
+      else up = inner(work)->anchor_update(mid, index, epoch_);
+
+      if(work == root_) { // work has been latched
+        merged = nullptr, up = false;
+        next = inner(work)->root_remove(epoch_);
+        if(next) {
+          root_ = next, tree_depth_--;
+          epoch_->retire(work);
+          assert(next == current);
+        } else if(Config::kInnerClassOpt) {
+          work = resize_root(work);
+        }
+        // ensure root is latched when setting global root, tree_depth,
+        // makes the three node one logical entity (old root, the merged
+        // node, new root(current)), so no other threads can modify global var
+        unlatch_exclusive(current);
+      }
+
+      current = work;
+    }
+
+    unlatch_exclusive(current);
+    return kv;
+  }
+
+  /* replace the root node (latched) by a copy of the size
+   * class that fits it, return the latched copy or node itself */
+  void* resize_root(void* node) {
+    bool is_leaf = this->is_leaf(node);
+    int size_class = is_leaf ? leaf(node)->fit_class() : inner(node)->fit_class();
+    if(size_class == control(node)->size_class()) return node;
+    void* copy;
+    if(is_leaf) {
+      copy = malloc(LeafNode::node_size(size_class));
+      new(copy) LeafNode(size_class);
+      latch_exclusive(copy);
+      leaf(node)->resize(leaf(copy));
+    } else {
+      copy = malloc(InnerNode::node_size(size_class));
+      new(copy) InnerNode(size_class);
+      latch_exclusive(copy);
+      inner(node)->resize(inner(copy), epoch_);
+    }
+    // node is latched, so no other threads can split it or modify root
+    root_track_[tree_depth_ - 1] = copy;
+    root_ = copy;
+    unlatch_exclusive(node);
+    epoch_->retire(node);
+    return copy;
+  }
+
+  // merge right sibling nodes into the leaf node while underfull, return the number of merges
+  int merge_run(void* node, int merge_size) {
+    int merges = 0;
+    while(leaf(node)->underfull(merge_size)) {
+      void* sibling = leaf(node)->sibling();
+      String* high = leaf(node)->high_key(); // in the epoch guard
+      remove(std::string_view(high->str, high->len), true, merge_size);
+      if(leaf(node)->sibling() == sibling) break; // stale high key, retry later
+      merges += 1;
+    }
+    return merges;
+  }
+
  public:
   FBTree() {
-    root_ = malloc(sizeof(LeafNode));
-    new(root_) LeafNode();
+    root_ = malloc(LeafNode::node_size(LeafNode::max_class()));
+    new(root_) LeafNode(LeafNode::max_class());
     tree_depth_ = 1;
     root_track_[0] = root_;
     epoch_ = new Epoch();
+    maintaining_ = false;
   }
 
   //By default, kv is destruct and then the memory block of kv is freed
   ~FBTree() { // recursive destructor result in stackoverflow
+    stop_maintenance();
     for(int rid = 0; rid < tree_depth_; rid++) {
       void* node = root_track_[rid], * sibling;
       while(node) {
@@ -696,6 +2343,81 @@ class alignas(64) FBTree<String, V> {
 
   Epoch& get_epoch() { return *epoch_; }
 
+  /* pack leaf nodes to about target_fill (0.5 ~ 1.0) of capacity by merging
+   * runs of sibling leaf nodes in place, concurrently with other operations,
+   * readers of a merged node are redirected to its left node as usual, and
+   * merged nodes are retired by epoch; return the number of merged nodes */
+  int compact(double target_fill) {
+    assert(epoch_->guarded());
+    constexpr int kLeafSize = Constant<String>::kLeafSize;
+    int merge_size = std::max<int>(target_fill * kLeafSize, Constant<String>::kLeafMergeSize);
+    merge_size = std::min(merge_size, kLeafSize);
+
+    int merges = 0;
+    void* node = root_track_[0];
+    while(node != nullptr) {
+      merges += merge_run(node, merge_size);
+      node = leaf(node)->sibling();
+    }
+    return merges;
+  }
+
+  /* start a thread which maintains the tree structure every interval, see
+   * maintain(), meanwhile remove no longer merges leaf nodes inline */
+  void start_maintenance(std::chrono::milliseconds interval = std::chrono::milliseconds(100)) {
+    if(maintaining_.exchange(true)) return; // already started
+    maintainer_ = std::thread([this, interval]() {
+      std::unique_lock<std::mutex> lock(maintain_mutex_);
+      while(maintaining_.load()) {
+        lock.unlock();
+        {
+          EpochGuard guard(*epoch_); // not held while sleeping, so retired memory is reclaimed
+          maintain();
+        }
+        lock.lock();
+        maintain_cv_.wait_for(lock, interval, [this]() { return !maintaining_.load(); });
+      }
+    });
+  }
+
+  void stop_maintenance() {
+    {
+      std::lock_guard<std::mutex> lock(maintain_mutex_);
+      if(!maintaining_.exchange(false)) return;
+    }
+    maintain_cv_.notify_all();
+    maintainer_.join();
+  }
+
+  /* one pass of structural maintenance: merge underfull sibling leaf nodes
+   * (and upper levels), sort unordered leaf nodes before scans need them, and
+   * compact extents of inner nodes; used by the maintenance thread, can also
+   * be called directly in the epoch guard, e.g., after a large delete */
+  void maintain() {
+    assert(epoch_->guarded());
+    void* node = root_track_[0]; // the leftmost leaf node, only resize_root replaces it
+    while(node != nullptr) {
+      merge_run(node, Constant<String>::kLeafMergeSize);
+
+      if(!control(node)->ordered()) {
+        latch_exclusive(node);
+        if(!control(node)->deleted()) leaf(node)->kv_sort();
+        unlatch_exclusive(node);
+      }
+      node = leaf(node)->sibling();
+    }
+
+    for(int rid = 1; rid < tree_depth_; rid++) { // inner levels
+      node = root_track_[rid];
+      while(node != nullptr) {
+        latch_exclusive(node);
+        if(!control(node)->deleted()) inner(node)->compact(epoch_);
+        unlatch_exclusive(node);
+        node = inner(node)->sibling();
+      }
+    }
+  }
+
   // kv should be allocated by malloc
   KVPair* upsert(KVPair* kv) {
     assert(epoch_->guarded());
@@ -729,14 +2451,15 @@ class alignas(64) FBTree<String, V> {
     int index, rootid = 0;// rootid: reverse traversal index
     void* rnode, * next;  // rnode: the new node
     String* mid = nullptr;
+    if(Config::kLeafClassOpt && current == root_) current = resize_root(current);
     KVPair* old = leaf(current)->upsert(kv, rnode, mid);
 
     while(rnode != nullptr) { // correctly insert the key to leaf node, splitting
       rootid += 1; // to upper level
       if(current == root_) {
         //root node need splitting
-        work = malloc(sizeof(InnerNode));
-        new(work) InnerNode();
+        work = malloc(InnerNode::node_size(InnerNode::max_class()));
+        new(work) InnerNode(InnerNode::max_class());
       } else if(!path_stack.empty()) {
         work = path_stack.back();
         path_stack.pop_back();
@@ -762,6 +2485,7 @@ class alignas(64) FBTree<String, V> {
         work = next;
       }
       unlatch_exclusive(current);
+      if(Config::kInnerClassOpt && work == root_) work = resize_root(work);
 
       // inner node insertion
       rnode = inner(work)->insert(mid, current, rnode, index, epoch_);
@@ -796,105 +2520,14 @@ class alignas(64) FBTree<String, V> {
     return upsert((char*) key.data(), key.size(), std::move(value));
   }
 
-  KVPair* remove(String& key) {
-    assert(epoch_->guarded());
-    std::vector<void*> path_stack;
-    path_stack.reserve(tree_depth_);
-
-    //traverse the btree to leaf node, save path to path stack
-    void* work, * current = root_;
-    Control* parent = control(current); // the parent of leaf nodes
-    uint64_t version = 0; // version of leaf node's parent; init with zero,
-    // so an extreme case can perform correctly (no inner node here initially);
-    // used to determine whether we need to move to sibling in leaf node
-
-    while(!is_leaf(current)) {
-      work = current, parent = control(current);
-      if(!inner(work)->to_next(key, current, version)) {
-        path_stack.push_back(work);
-      } // move to a child or a sibling
-      node_prefetch(current);
-    }
-
-    // reach leaf node
-    latch_exclusive(current);
-    while(leaf(current)->to_sibling(key, work, parent, version)) {
-      assert(work != nullptr);
-      latch_exclusive(work);
-      unlatch_exclusive(current);
-      current = work;
-    }
-
-    int index, rootid = 0;
-    void* merged, * next;
-    String* mid;
-    KVPair* kv = leaf(current)->remove(key, merged, mid);
-    if(merged) epoch_->retire(mid); // anchor keys are only store in leaf nodes
-
-    bool up = false; // need to update upper level key
-    while(merged || up) {
-      epoch_->retire(merged);
-      rootid += 1;
-
-      if(!path_stack.empty()) {
-        work = path_stack.back();
-        path_stack.pop_back();
-      } else {
-        work = root_track_[rootid];
-      }
-      assert(work != nullptr);
-
-      latch_exclusive(work);
-      while(inner(work)->index_or_sibling(*mid, next, index)) {
-        assert(next != nullptr);
-        latch_exclusive(next);
-        unlatch_exclusive(work);
-        work = next;
-      }
-      if(work != root_) unlatch_exclusive(current);
-
-      if(merged) merged = inner(work)->remove(mid, up, index, epoch_);
-      else up = inner(work)->anchor_update(mid, index, epoch_);
-
-      if(work == root_) { // work has been latched
-        merged = nullptr, up = false;
-        next = inner(work)->root_remove(epoch_);
-        if(next) {
-          root_ = next, tree_depth_--;
-          epoch_->retire(work);
-          assert(next == current);
-        }
-        // ensure root is latched when setting global root, tree_depth,
-        // makes the three node one logical entity (old root, the merged
-        // node, new root(current)), so no other threads can modify global var
-        unlatch_exclusive(current);
-      }
-
-      current = work;
-    }
+  KVPair* remove(std::string_view key) { return remove(key, false, 0); }
 
-    unlatch_exclusive(current);
-    return kv;
+  KVPair* remove(String& key) {
+    return remove(std::string_view(key.str, key.len));
   }
 
   KVPair* remove(char* key, int len) {
-    char buf[kBufSize + sizeof(String)];
-    String* str;
-
-    if(len <= kBufSize) str = (String*) buf;
-    else str = (String*) malloc(sizeof(String) + len);
-
-    str->len = len;
-    memcpy(str->str, key, len);
-    KVPair* kv = remove(*str);
-
-    if(len > kBufSize) free(str);
-
-    return kv;
-  }
-
-  KVPair* remove(const std::string& key) {
-    return remove((char*) key.data(), key.size());
+    return remove(std::string_view(key, len));
   }
 
   // kv should be allocated by malloc
@@ -951,7 +2584,7 @@ class alignas(64) FBTree<String, V> {
     return update((char*) key.data(), key.size(), std::move(value));
   }
 
-  KVPair* lookup(String& key) {
+  KVPair* lookup(std::string_view key) {
     assert(epoch_->guarded());
     void* node = root_;
     Control* parent = control(node);
@@ -977,89 +2610,70 @@ class alignas(64) FBTree<String, V> {
     return nullptr;
   }
 
-  KVPair* lookup(char* key, int len) {
-    char buf[kBufSize + sizeof(String)];
-    String* str;
-
-    if(len <= kBufSize) str = (String*) buf;
-    else str = (String*) malloc(sizeof(String) + len);
-
-    str->len = len;
-    memcpy(str->str, key, len);
-    KVPair* kv = lookup(*str);
-
-    if(len > kBufSize) free(str);
-
-    return kv;
+  KVPair* lookup(String& key) {
+    return lookup(std::string_view(key.str, key.len));
   }
 
-  KVPair* lookup(const std::string& key) {
-    return lookup((char*) key.data(), key.size());
+  KVPair* lookup(char* key, int len) {
+    return lookup(std::string_view(key, len));
   }
 
   iterator begin() {
     assert(epoch_->guarded());
     LeafNode* node = leaf(root_track_[0]);
     assert(node != nullptr);
-    iterator it(node, 0, nullptr, 0);
-    it.version_ = control(node)->begin_read();
-    std::tie(it.kv_, it.pos_, it.version_) =
-      node->access(nullptr, 0, it.version_);
-    return it;
+    uint64_t version;
+    KVPair* kv = nullptr;
+    int pos = 0;
+    while(true) {
+      version = control(node)->begin_read();
+      if(!control(node)->deleted()) {
+        std::tie(kv, pos, version) = node->access(nullptr, 0, version);
+        if(kv != nullptr) break;
+      }
+
+      // an empty node left by a lazy removal or a deferred merge, or a deleted node
+      // (the root leaf node replaced by resize_root), go on to its sibling
+      LeafNode* next = (LeafNode*) (node->sibling());
+      if(!control(node)->end_read(version)) continue; // filled or split meanwhile, retry
+      if(next == nullptr) break; // the tree is empty
+      node = next;
+    }
+    return iterator(node, version, kv, pos);
   }
 
-  iterator lower_bound(String& key) {
+  iterator lower_bound(std::string_view key) {
     return bound(key, false);
   }
 
-  iterator lower_bound(char* key, int len) {
-    char buf[kBufSize + sizeof(String)];
-    String* str;
-
-    if(len <= kBufSize) str = (String*) buf;
-    else str = (String*) malloc(sizeof(String) + len);
-
-    str->len = len;
-    memcpy(str->str, key, len);
-    iterator it = lower_bound(*str);
-
-    if(len > kBufSize) free(str);
-
-    return it;
+  iterator lower_bound(String& key) {
+    return bound(std::string_view(key.str, key.len), false);
   }
 
-  iterator lower_bound(const std::string& key) {
-    return lower_bound((char*) key.data(), key.size());
+  iterator lower_bound(char* key, int len) {
+    return bound(std::string_view(key, len), false);
   }
 
-  iterator upper_bound(String& key) {
+  iterator upper_bound(std::string_view key) {
     return bound(key, true);
   }
 
-  iterator upper_bound(char* key, int len) {
-    char buf[kBufSize + sizeof(String)];
-    String* str;
-
-    if(len <= kBufSize) str = (String*) buf;
-    else str = (String*) malloc(sizeof(String) + len);
-
-    str->len = len;
-    memcpy(str->str, key, len);
-    iterator it = upper_bound(*str);
-
-    if(len > kBufSize) free(str);
-
-    return it;
+  iterator upper_bound(String& key) {
+    return bound(std::string_view(key.str, key.len), true);
   }
 
-  iterator upper_bound(const std::string& key) {
-    return upper_bound((char*) key.data(), key.size());
+  iterator upper_bound(char* key, int len) {
+    return bound(std::string_view(key, len), true);
   }
 };
 
 template<typename V>
 class FBTree<std::string, V> : public FBTree<String, V> {};
 
+// keys are converted to FixedKey<N> implicitly, and scans return FixedKey<N> keys (see FixedKey::array)
+template<size_t N, typename V>
+class FBTree<std::array<uint8_t, N>, V> : public FBTree<FixedKey<N>, V> {};
+
 }
 
 #endif //INDEXRESEARCH_FBTREE_H
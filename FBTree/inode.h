@@ -10,6 +10,7 @@
 #include <iostream>
 #include <cassert>
 #include <cstring>
+#include <string_view>
 #include <vector>
 #include <map>
 #include "config.h"
@@ -27,13 +28,11 @@ namespace FeatureBTree {
 
 using util::String;
 using util::Epoch;
-using util::compare;
 using util::popcount;
 using util::index_least1;
 using util::countl_zero;
 using util::hash;
 using util::prefetcht0;
-using util::common_prefix;
 using util::aligned;
 using util::roundup;
 using util::branch_likely;
@@ -100,12 +99,13 @@ class alignas(Config::kAlignSize) InnerNode {
   static constexpr int kNodeSize = Constant<K>::kInnerSize;
   static constexpr int kMergeSize = Constant<K>::kInnerMergeSize;
   static constexpr int kFeatureSize = Constant<K>::kFeatureSize;
+  static constexpr int kPrefixSize = kFeatureSize > 8 ? kFeatureSize : 8;
   static constexpr int kBitCnt = 64; // bits number of bitmap
 
   Control control_; // synchronization, memory/compiler order
   int knum_;        // the number of keys
   int plen_;        // the length of prefix
-  char prefix_[8];  // prefix, shift subsequent bytes left
+  char prefix_[kPrefixSize];  // prefix, shift subsequent bytes left
   void* next_;      // sibling or last child
   char features_[kFeatureSize][kNodeSize];
   void* children_[kNodeSize];
@@ -278,7 +278,8 @@ class alignas(Config::kAlignSize) InnerNode {
     if(!control_.has_sibling()) control_.set_sibling();
     else rnode->control_.set_sibling();
 
-    int midx;
+    // keys left in current node, uneven if inserting at either end
+    int midx, half = split_point(index, kNodeSize, false);
     if(index == kNodeSize) {// index == kNodeSize can only exist in the rightmost node
       // the rightmost node without sibling and key is greater than all keys
       *(K*) rnode->prefix_ = mid;
@@ -288,60 +289,60 @@ class alignas(Config::kAlignSize) InnerNode {
       rnode->knum_ = 1;
 
       midx = kNodeSize - 1;
-    } else if(index < kNodeSize / 2) {
+    } else if(index < half) {
       memory_expand();
-      // move right half separators and children to right node
+      // move right part separators and children to right node
       for(int rid = 0; rid < kFeatureSize; rid++) {
-        src = features_[rid] + kNodeSize / 2;
+        src = features_[rid] + half;
         dst = rnode->features_[rid];
-        memcpy(dst, src, kNodeSize / 2);
+        memcpy(dst, src, kNodeSize - half);
       }
-      src = children_ + kNodeSize / 2;
+      src = children_ + half;
       dst = rnode->children_;
-      memmove64(src, dst, kNodeSize / 2, true);
+      memmove64(src, dst, kNodeSize - half, true);
 
       //insert lhigh to left inner node
       for(int rid = 0; rid < kFeatureSize; rid++) {
         src = features_[rid] + index;
         dst = features_[rid] + index + 1;
-        memmove(dst, src, kNodeSize / 2 - index);
+        memmove(dst, src, half - index);
         features_[rid][index] = ((char*) &mid)[rid];
       }
       src = children_ + index, dst = children_ + index + 1;
-      memmove64(src, dst, kNodeSize / 2 - index, false);
+      memmove64(src, dst, half - index, false);
       children_[index + 1] = rchild;
 
-      knum_ = kNodeSize / 2 + 1;
-      rnode->knum_ = kNodeSize / 2;
+      knum_ = half + 1;
+      rnode->knum_ = kNodeSize - half;
       memory_shrink();
       rnode->memory_shrink();
 
-      midx = kNodeSize / 2;
-    } else { // kNodeSize / 2 <= index < kNodeSize
+      midx = half;
+    } else { // half <= index < kNodeSize
       memory_expand();
       for(int rid = 0; rid < kFeatureSize; rid++) {
-        src = features_[rid] + kNodeSize / 2;
+        src = features_[rid] + half;
         dst = rnode->features_[rid];
-        memcpy(dst, src, index - kNodeSize / 2);
-        rnode->features_[rid][index - kNodeSize / 2] = ((char*) &mid)[rid];
+        memcpy(dst, src, index - half);
+        rnode->features_[rid][index - half] = ((char*) &mid)[rid];
         src = features_[rid] + index;
-        dst = rnode->features_[rid] + index - kNodeSize / 2 + 1;
+        dst = rnode->features_[rid] + index - half + 1;
         memcpy(dst, src, kNodeSize - index);
       }
 
-      src = children_ + kNodeSize / 2, dst = rnode->children_;
-      memmove64(src, dst, index - kNodeSize / 2 + 1, true);
-      rnode->children_[index - kNodeSize / 2 + 1] = rchild;
+      src = children_ + half, dst = rnode->children_;
+      memmove64(src, dst, index - half + 1, true);
+      rnode->children_[index - half + 1] = rchild;
       src = children_ + index + 1;
-      dst = rnode->children_ + index - kNodeSize / 2 + 2;
+      dst = rnode->children_ + index - half + 2;
       memmove64(src, dst, kNodeSize - index - 1, true);
 
-      knum_ = kNodeSize / 2;
-      rnode->knum_ = kNodeSize / 2 + 1;
+      knum_ = half;
+      rnode->knum_ = kNodeSize - half + 1;
       memory_shrink();
       rnode->memory_shrink();
 
-      midx = kNodeSize / 2 - 1;
+      midx = half - 1;
     }
 
     for(int rid = 0; rid < kFeatureSize; rid++) {
@@ -489,6 +490,42 @@ class alignas(Config::kAlignSize) InnerNode {
     stat["inner num"] += 1;
   }
 
+  /* append children of current node with the exclusive lower bounds of their key
+   * ranges (normal encoding form) to out, low is the lower bound of current node,
+   * read optimistically, return false if current node has been deleted */
+  bool child_bounds(K low, std::vector<std::pair<K, void*>>& out) {
+    size_t size = out.size();
+    while(true) {
+      uint64_t version = control_.begin_read();
+      if(control_.deleted()) return false;
+      K bound = low;
+      for(int kid = 0; kid < knum_ && kid < kNodeSize; kid++) {
+        out.emplace_back(bound, children_[kid]);
+        bound = *(K*) prefix_; // restore the separator from prefix and features
+        for(int fid = 0; fid < kFeatureSize - plen_; fid++)
+          ((char*) &bound)[fid + plen_] = features_[fid][kid];
+        bound = encode_reconvert(bound);
+      }
+      // next_ is the last child of the rightmost node, otherwise the sibling
+      if(!control_.has_sibling()) out.emplace_back(bound, next_);
+      if(control_.end_read(version)) return true;
+      out.resize(size);
+    }
+  }
+
+  /* the position of the child next among the children of current node, and the
+   * number of children (fanout), read optimistically, for estimates only */
+  int position(void* next, int& fanout) {
+    while(true) {
+      uint64_t version = control_.begin_read();
+      int knum = knum_ < kNodeSize ? knum_ : kNodeSize, pos = 0;
+      while(pos < knum && children_[pos] != next) pos++;
+      // next_ is the last child of the rightmost node, otherwise the sibling
+      fanout = control_.has_sibling() ? knum : knum + 1;
+      if(control_.end_read(version)) return pos;
+    }
+  }
+
   func_used void exhibit() {
     K keys[kNodeSize];
     for(int kid = 0; kid < knum_; kid++) {
@@ -680,6 +717,7 @@ class alignas(Config::kAlignSize) InnerNode<String> {
   static constexpr bool kExtentOpt = Config::kExtentOpt;
   static constexpr int kExtentSize = Config::kExtentSize;
   static constexpr int kEmbedPrSize = 224; // length of embedded prefix
+  static constexpr int kMaxClass = Config::kInnerClassOpt ? kNodeSize / 32 : 0; // at least 16 entries
   static constexpr int kBitCnt = 64; // bits number of bitmap
   /* for a slab memory allocator like jemalloc, malloc always allocates a memory
    * block whose size is grater than or equal to the size we need, so we use the
@@ -688,6 +726,9 @@ class alignas(Config::kAlignSize) InnerNode<String> {
    * 896 - 32 - 4 * 32 - 8 * 32 - 8 * 32 = 224, feature size: 4, node size: 32 */
   /* if kExtentOpt(false), anchors are actually stored in leaf nodes, inner nodes only
    * store pointers to anchors, else store anchors with contiguous memory in extent */
+  /* a node of size class c (Config::kInnerClassOpt) holds kNodeSize >> c anchors,
+   * its anchors and children follow the embedded prefix, which is dropped in the
+   * smallest class; the members below are the layout of size class 0 */
 
   Control control_;  // synchronization, memory/compiler order
   int knum_;         // the number of anchor/separator keys
@@ -722,6 +763,18 @@ class alignas(Config::kAlignSize) InnerNode<String> {
       return compare_less_16(p, c);
   }
 
+  int capacity() { return kNodeSize >> control_.size_class(); }
+
+  static int embed_size(int size_class) {
+    return size_class > 0 && size_class == kMaxClass ? 0 : kEmbedPrSize;
+  }
+
+  int embed_size() { return embed_size(control_.size_class()); }
+
+  String** anchors() { return (String**) (tiny_ + embed_size()); }
+
+  void** children() { return (void**) (anchors() + capacity()); }
+
   uint64_t bitmap() {
     DEBUG_COND_ERROR(knum_ < 0 || knum_ > kNodeSize, "error knum");
     if(kNodeSize == 64) { // avoid undefined behavior in shift operation
@@ -731,17 +784,17 @@ class alignas(Config::kAlignSize) InnerNode<String> {
   }
 
   /* 0: equal, minus value: key less than node prefix */
-  int prefix_compare(String& key) {
+  int prefix_compare(std::string_view key) {
     int plen = plen_, pcmp;
-    int cmps = std::min(key.len, plen);
+    int cmps = std::min((int) key.size(), plen);
 
-    if(cmps <= kEmbedPrSize) { // embedded prefix
+    if(plen <= embed_size()) { // embedded prefix, tiny_ is only valid when plen fits
       prefetcht0(tiny_); // prefetch a cache line
-      pcmp = memcmp(key.str, tiny_, cmps);
+      pcmp = memcmp(key.data(), tiny_, cmps);
     } else if(!kExtentOpt && huge_->len >= cmps) {
-      pcmp = memcmp(key.str, huge_->str, cmps);
+      pcmp = memcmp(key.data(), huge_->str, cmps);
     } else if(kExtentOpt && extent_->huge()->len >= cmps) {
-      pcmp = memcmp(key.str, extent_->huge()->str, cmps);
+      pcmp = memcmp(key.data(), extent_->huge()->str, cmps);
     } // current node has modified by others, retry
 
     // key.len < plen: can't be equal
@@ -749,12 +802,12 @@ class alignas(Config::kAlignSize) InnerNode<String> {
     return pcmp;
   }
 
-  int to_next_phase1(String& key, void*& next, bool& to_sibling) {
+  int to_next_phase1(std::string_view key, void*& next, bool& to_sibling) {
     int pcmp = prefix_compare(key);
 
     if(pcmp < 0) {
       // key is less than node prefix
-      next = children_[0];
+      next = children()[0];
     } else if(pcmp > 0) {
       // key is greater than node prefix
       next = next_;
@@ -766,7 +819,7 @@ class alignas(Config::kAlignSize) InnerNode<String> {
     return pcmp;
   }
 
-  int index_phase1(String& key, void*& next, int& index, bool& to_sibling) {
+  int index_phase1(std::string_view key, void*& next, int& index, bool& to_sibling) {
     int pcmp = prefix_compare(key);
 
     if(pcmp < 0) {
@@ -782,22 +835,22 @@ class alignas(Config::kAlignSize) InnerNode<String> {
     return pcmp;
   }
 
-  int suffix_bs(String& key, int cmps, int lid, int hid) {
+  int suffix_bs(std::string_view key, int cmps, int lid, int hid) {
     // suffix binary search, cmps: compared size
-    assert(key.len >= cmps && hid > lid);
-    char* kstr = key.str + cmps, * sep;
-    int ks = key.len - cmps, seps;
+    assert(key.size() >= cmps && hid > lid);
+    char* kstr = (char*) key.data() + cmps, * sep;
+    int ks = key.size() - cmps, seps;
     int mid, cmp;
 
     while(lid < hid) {
       mid = (lid + hid) / 2;
-      sep = anchors_[mid]->str + cmps;
-      seps = anchors_[mid]->len - cmps;
+      sep = anchors()[mid]->str + cmps;
+      seps = anchors()[mid]->len - cmps;
 
       if(seps < 0) return mid;
       // current node has been modified, retry
 
-      cmp = compare(kstr, ks, sep, seps);
+      cmp = key_compare(kstr, ks, sep, seps);
       if(cmp < 0) { hid = mid; }
       else if(cmp == 0) return mid;
       else { lid = mid + 1; }
@@ -820,17 +873,17 @@ class alignas(Config::kAlignSize) InnerNode<String> {
   }
 
   /* adjust the size and arrangement of extent, required memory length */
-  void extent_resize(Epoch* epoch, int rlen) {
-    if(extent_->left() < rlen) {
+  void extent_resize(Epoch* epoch, int rlen, bool force = false) {
+    if(force || extent_->left() < rlen) {
       int size = extent_->used() + rlen;
       size = roundup(size, kExtentSize);
       Extent* ext = (Extent*) malloc(size);
       ext->init(size); // copy anchors to ext
       for(int kid = 0; kid < knum_; kid++) {
-        anchors_[kid] = ext->make_anchor(anchors_[kid]);
-        assert(anchors_[kid] != nullptr);
+        anchors()[kid] = ext->make_anchor(anchors()[kid]);
+        assert(anchors()[kid] != nullptr);
       }
-      if(knum_ > 0) ext->huge(anchors_[0]);
+      if(knum_ > 0) ext->huge(anchors()[0]);
       epoch->retire(extent_);
       extent_ = ext;
     }
@@ -860,17 +913,17 @@ class alignas(Config::kAlignSize) InnerNode<String> {
      * init, index == 0; normal node (whose next_ pointer points to
      * sibling): prefix adjust, index == 0 (index == knum - 1 can never
      * happen); right most node: prefix adjust index == 0 | knum - 1 */
-    int fs = anchors_[0]->len, ls = anchors_[knum_ - 1]->len;
-    char* fk = anchors_[0]->str, * lk = anchors_[knum_ - 1]->str;
-    plen_ = common_prefix(fk, fs, lk, ls);
-    if(!kExtentOpt) huge_ = anchors_[0];
-    else extent_->huge(anchors_[0]);
-    if(plen_ <= kEmbedPrSize) { memcpy(tiny_, fk, plen_); }
+    int fs = anchors()[0]->len, ls = anchors()[knum_ - 1]->len;
+    char* fk = anchors()[0]->str, * lk = anchors()[knum_ - 1]->str;
+    plen_ = key_common_prefix(fk, fs, lk, ls);
+    if(!kExtentOpt) huge_ = anchors()[0];
+    else extent_->huge(anchors()[0]);
+    if(plen_ <= embed_size()) { memcpy(tiny_, fk, plen_); }
 
     for(int kid = 0; kid < knum_; kid++) {
       for(int fid = 0; fid < kFeatureSize; fid++) {
-        char ft = (plen_ + fid) < anchors_[kid]->len ?
-                  anchors_[kid]->str[plen_ + fid] : 0;
+        char ft = (plen_ + fid) < anchors()[kid]->len ?
+                  anchors()[kid]->str[plen_ + fid] : 0;
         features_[fid][kid] = ft + 128;// byte encoding conversion
       }
     }
@@ -885,85 +938,88 @@ class alignas(Config::kAlignSize) InnerNode<String> {
     if(!control_.has_sibling()) control_.set_sibling();
     else rnode->control_.set_sibling();
 
+    // keys left in current node, uneven if inserting at either end
+    DEBUG_COND_ERROR(control_.size_class() != 0, "split a small inner node");
+    int half = split_point(index, kNodeSize, false);
     if(index == kNodeSize) { // index == kNodeSize can only exist in the rightmost node
       // the rightmost node without sibling and key is greater than all keys
       if(kExtentOpt) key = rnode->make_anchor(epoch, key);
-      rnode->anchors_[0] = key;
-      rnode->children_[0] = lchild;
+      rnode->anchors()[0] = key;
+      rnode->children()[0] = lchild;
       rnode->next_ = rchild;
       rnode->knum_ = 1;
 
       rnode->content_rebuild();
-      key = anchors_[kNodeSize - 1];
-    } else if(index < kNodeSize / 2) {
-      // move right half separators and children to right node
+      key = anchors()[kNodeSize - 1];
+    } else if(index < half) {
+      // move right part separators and children to right node
       if(kExtentOpt) {
         // allocate a large enough memory block to prevent resize
         rnode->extent_resize(epoch, extent_->used());
-        for(int kid = kNodeSize / 2; kid < kNodeSize; kid++) {
-          String* k = rnode->make_anchor(epoch, anchors_[kid]);
-          ruin_anchor(epoch, anchors_[kid]);
-          rnode->anchors_[kid - kNodeSize / 2] = k;
+        for(int kid = half; kid < kNodeSize; kid++) {
+          String* k = rnode->make_anchor(epoch, anchors()[kid]);
+          ruin_anchor(epoch, anchors()[kid]);
+          rnode->anchors()[kid - half] = k;
         }
       } else {
-        src = anchors_ + kNodeSize / 2, dst = rnode->anchors_;
-        memmove64(src, dst, kNodeSize / 2, true);
+        src = anchors() + half, dst = rnode->anchors();
+        memmove64(src, dst, kNodeSize - half, true);
       }
-      src = children_ + kNodeSize / 2, dst = rnode->children_;
-      memmove64(src, dst, kNodeSize / 2, true);
+      src = children() + half, dst = rnode->children();
+      memmove64(src, dst, kNodeSize - half, true);
 
       //insert lhigh to left inner node
-      if(kExtentOpt) { knum_ = kNodeSize / 2, key = make_anchor(epoch, key); }
-      src = anchors_ + index, dst = anchors_ + index + 1;
-      memmove64(src, dst, kNodeSize / 2 - index, false);
-      src = children_ + index, dst = children_ + index + 1;
-      memmove64(src, dst, kNodeSize / 2 - index, false);
-      anchors_[index] = key;
-      children_[index + 1] = rchild;
+      if(kExtentOpt) { knum_ = half, key = make_anchor(epoch, key); }
+      src = anchors() + index, dst = anchors() + index + 1;
+      memmove64(src, dst, half - index, false);
+      src = children() + index, dst = children() + index + 1;
+      memmove64(src, dst, half - index, false);
+      anchors()[index] = key;
+      children()[index + 1] = rchild;
 
-      knum_ = kNodeSize / 2 + 1;
-      rnode->knum_ = kNodeSize / 2;
+      knum_ = half + 1;
+      rnode->knum_ = kNodeSize - half;
 
       content_rebuild();
       rnode->content_rebuild();
 
-      key = anchors_[kNodeSize / 2];
-    } else { // kNodeSize / 2 <= index < kNodeSize
-      int ncp = index - kNodeSize / 2;
+      key = anchors()[half];
+    } else { // half <= index < kNodeSize
+      int ncp = index - half;
       if(kExtentOpt) {
-        for(int kid = kNodeSize / 2; kid < kNodeSize; kid++) {
+        for(int kid = half; kid < kNodeSize; kid++) {
           if(kid == index) {
             key = rnode->make_anchor(epoch, key);
-            rnode->anchors_[index - kNodeSize / 2] = key;
+            rnode->anchors()[index - half] = key;
             rnode->knum_ += 1;
           }
-          String* k = rnode->make_anchor(epoch, anchors_[kid]);
-          ruin_anchor(epoch, anchors_[kid]);
-          if(kid < index) rnode->anchors_[kid - kNodeSize / 2] = k;
-          else rnode->anchors_[kid - kNodeSize / 2 + 1] = k;
+          String* k = rnode->make_anchor(epoch, anchors()[kid]);
+          ruin_anchor(epoch, anchors()[kid]);
+          if(kid < index) rnode->anchors()[kid - half] = k;
+          else rnode->anchors()[kid - half + 1] = k;
           rnode->knum_ += 1;
         }
       } else {
-        src = anchors_ + kNodeSize / 2, dst = rnode->anchors_;
+        src = anchors() + half, dst = rnode->anchors();
         memmove64(src, dst, ncp, true);
-        src = anchors_ + index, dst = rnode->anchors_ + ncp + 1;
+        src = anchors() + index, dst = rnode->anchors() + ncp + 1;
         memmove64(src, dst, kNodeSize - index, true);
-        rnode->anchors_[index - kNodeSize / 2] = key;
+        rnode->anchors()[index - half] = key;
       }
 
-      src = children_ + kNodeSize / 2, dst = rnode->children_;
+      src = children() + half, dst = rnode->children();
       memmove64(src, dst, ncp + 1, true);
-      src = children_ + index + 1, dst = rnode->children_ + ncp + 2;
+      src = children() + index + 1, dst = rnode->children() + ncp + 2;
       memmove64(src, dst, kNodeSize - index - 1, true);
-      rnode->children_[index - kNodeSize / 2 + 1] = rchild;
+      rnode->children()[index - half + 1] = rchild;
 
-      knum_ = kNodeSize / 2;
-      rnode->knum_ = kNodeSize / 2 + 1;
+      knum_ = half;
+      rnode->knum_ = kNodeSize - half + 1;
 
       content_rebuild();
       rnode->content_rebuild();
 
-      key = anchors_[kNodeSize / 2 - 1];
+      key = anchors()[half - 1];
     }
 
     return rnode;
@@ -982,25 +1038,25 @@ class alignas(Config::kAlignSize) InnerNode<String> {
         // if rnkey = 0 (rightmost inner), merge immediately
         // ensure need to merge with right node
         if(knum_ + rnkey <= kMergeSize || rnkey == 0) {
-          merged = rnode, key = anchors_[knum_ - 1];
+          merged = rnode, key = anchors()[knum_ - 1];
 
           // move separators in rnode to current node
           if(kExtentOpt) {
             extent_resize(epoch, rnode->extent_->used());
             for(int kid = 0; kid < rnkey; kid++) {
-              anchors_[knum_++] = make_anchor(epoch, rnode->anchors_[kid]);
-              rnode->ruin_anchor(epoch, rnode->anchors_[kid]);
+              anchors()[knum_++] = make_anchor(epoch, rnode->anchors()[kid]);
+              rnode->ruin_anchor(epoch, rnode->anchors()[kid]);
             }
-            void* src = rnode->children_;
-            void* dst = children_ + knum_ - rnkey;
+            void* src = rnode->children();
+            void* dst = children() + knum_ - rnkey;
             memmove64(src, dst, rnkey, true);
             rnode->knum_ = 0, epoch->retire(rnode->extent_);
           } else {
-            void* src = rnode->anchors_;
-            void* dst = anchors_ + knum_;
+            void* src = rnode->anchors();
+            void* dst = anchors() + knum_;
             memmove64(src, dst, rnkey, true);
-            src = rnode->children_;
-            dst = children_ + knum_;
+            src = rnode->children();
+            dst = children() + knum_;
             memmove64(src, dst, rnkey, true);
             knum_ += rnkey, rnode->knum_ = 0;
           }
@@ -1025,7 +1081,7 @@ class alignas(Config::kAlignSize) InnerNode<String> {
     void* merged = nullptr;
     if(!control_.has_sibling()) {
       // current node is the right-most node
-      next_ = children_[index];
+      next_ = children()[index];
       knum_ -= 1;
       // if no anchors in current node(root, right-most node), set plen
       // to zero, guaranteeing lookup operation can be performed correctly
@@ -1047,19 +1103,19 @@ class alignas(Config::kAlignSize) InnerNode<String> {
         if(kExtentOpt) {
           knum_ -= 1, extent_resize(epoch, rnode->extent_->used());
           for(int kid = 0; kid < rnkey; kid++) {
-            anchors_[knum_++] = make_anchor(epoch, rnode->anchors_[kid]);
-            rnode->ruin_anchor(epoch, rnode->anchors_[kid]);
+            anchors()[knum_++] = make_anchor(epoch, rnode->anchors()[kid]);
+            rnode->ruin_anchor(epoch, rnode->anchors()[kid]);
           }
-          void* src = rnode->children_ + 1;
-          void* dst = children_ + knum_ - rnkey + 1;
+          void* src = rnode->children() + 1;
+          void* dst = children() + knum_ - rnkey + 1;
           memmove64(src, dst, rnkey ? rnkey - 1 : 0, true);
           rnode->knum_ = 0, epoch->retire(rnode->extent_);
         } else {
-          void* src = rnode->anchors_;
-          void* dst = anchors_ + index;
+          void* src = rnode->anchors();
+          void* dst = anchors() + index;
           memmove64(src, dst, rnkey, true);
-          src = rnode->children_ + 1;
-          dst = children_ + knum_;
+          src = rnode->children() + 1;
+          dst = children() + knum_;
           memmove64(src, dst, rnkey ? rnkey - 1 : 0, true);
           knum_ += rnkey - 1, rnode->knum_ = 0;
         }
@@ -1067,7 +1123,7 @@ class alignas(Config::kAlignSize) InnerNode<String> {
 
         // set meta information
         if(rnkey != 0) next_ = rnode->next_;
-        else next_ = children_[index]; // rightmost node has no key
+        else next_ = children()[index]; // rightmost node has no key
         rnode->next_ = this;
         if(!rnode->control_.has_sibling())
           control_.clear_sibling();
@@ -1075,8 +1131,8 @@ class alignas(Config::kAlignSize) InnerNode<String> {
       } else {
         // to ensure other threads execute correctly when border remove happens
         // move the last one child (the child after merge) to sibling
-        up = true, key = anchors_[index - 1];
-        rnode->children_[0] = children_[index];
+        up = true, key = anchors()[index - 1];
+        rnode->children()[0] = children()[index];
         knum_ -= 1;
         content_rebuild();
       }
@@ -1088,7 +1144,8 @@ class alignas(Config::kAlignSize) InnerNode<String> {
   }
 
  public:
-  InnerNode() : control_(false), knum_(0), plen_(0), next_(nullptr) {
+  explicit InnerNode(int size_class = 0)
+    : control_(false, size_class), knum_(0), plen_(0), next_(nullptr) {
     if(kExtentOpt) {
       extent_ = (Extent*) malloc(Config::kExtentSize);
       extent_->init(Config::kExtentSize);
@@ -1103,15 +1160,68 @@ class alignas(Config::kAlignSize) InnerNode<String> {
   }
 
   void statistic(std::map<std::string, double>& stat) {
-    stat["index size"] += sizeof(InnerNode);
+    stat["index size"] += node_size(control_.size_class());
     if(kExtentOpt) stat["index size"] += extent_->size();
     stat["inner num"] += 1;
   }
 
+  // memory size of an inner node of the size class
+  static size_t node_size(int size_class) {
+    int nfree = kNodeSize - (kNodeSize >> size_class); // entries not allocated
+    return sizeof(InnerNode) - (kEmbedPrSize - embed_size(size_class))
+           - nfree * (sizeof(String*) + sizeof(void*));
+  }
+
+  // the size class of the fewest entries, a new root node is created of it
+  static constexpr int max_class() { return kMaxClass; }
+
+  /* the size class current node should be resized to, current node must be
+   * latched: the next larger class if full, the smallest class with at least
+   * twice as many entries as anchors if at most a quarter full, otherwise its own */
+  int fit_class() {
+    int size_class = control_.size_class();
+    if(size_class > 0 && knum_ >= (kNodeSize >> size_class)) return size_class - 1;
+    if(size_class < kMaxClass && knum_ * 4 <= (kNodeSize >> size_class)) {
+      while(size_class < kMaxClass && knum_ * 2 <= (kNodeSize >> (size_class + 1)))
+        size_class += 1;
+    }
+    return size_class;
+  }
+
+  /* move all anchors, children and meta information into node, a new inner node
+   * of another size class, both must be latched; current node is deleted like a
+   * merged node, its next_ points to node, so concurrent threads move to node */
+  void resize(InnerNode* node, Epoch* epoch) {
+    DEBUG_COND_ERROR(knum_ > (kNodeSize >> node->control_.size_class()), "resize error");
+    if(kExtentOpt) {
+      node->extent_resize(epoch, extent_->used());
+      for(int kid = 0; kid < knum_; kid++)
+        node->anchors()[kid] = node->make_anchor(epoch, anchors()[kid]);
+      epoch->retire(extent_);
+    } else { memmove64(anchors(), node->anchors(), knum_, true); }
+    memmove64(children(), node->children(), knum_, true);
+    node->knum_ = knum_;
+    node->next_ = next_;
+    if(control_.has_sibling()) node->control_.set_sibling();
+    if(knum_ > 0) node->content_rebuild();
+
+    next_ = node;
+    control_.set_delete();
+    control_.update_version();
+  }
+
+  // reclaim space of ruined anchors in extent, current node must be latched
+  void compact(Epoch* epoch) {
+    if(kExtentOpt && roundup(extent_->used(), kExtentSize) < extent_->size()) {
+      extent_resize(epoch, 0, true);
+      control_.update_version();
+    }
+  }
+
   func_used void exhibit() {
     std::vector<std::string> keys;
     for(int kid = 0; kid < knum_; kid++) {
-      String& key = *anchors_[kid];
+      String& key = *anchors()[kid];
       keys.push_back(std::string(key.str, key.len));
     }
     std::cout << "inner node " << this << ", prefix len: " << plen_
@@ -1124,6 +1234,10 @@ class alignas(Config::kAlignSize) InnerNode<String> {
   }
 
   bool to_next(String& key, void*& next, uint64_t& version) {
+    return to_next(std::string_view(key.str, key.len), next, version);
+  }
+
+  bool to_next(std::string_view key, void*& next, uint64_t& version) {
     // if next points to a child, return false, else next points to sibling, return true
     bool to_sibling;
 
@@ -1142,22 +1256,22 @@ class alignas(Config::kAlignSize) InnerNode<String> {
 
       if(branch_likely(!pcmp)) { // prefix of key is equal to node prefix
         int idx, rid, plen = plen_; // rid: row index, from higher byte to lower byte
-        if(key.len < plen) continue; // current node has modified by other threads
+        if(key.size() < plen) continue; // current node has modified by other threads
 
         uint64_t mask, eqmask = bitmap();
-        int cmps = std::min(kFeatureSize, key.len - plen); // feature compare bound
+        int cmps = std::min(kFeatureSize, (int) key.size() - plen); // feature compare bound
 
         // ok, thanks to gcc/g++, dynamic hardware scheduling, speculation and super-scalar,
         // we do not have to do loop unrolling manually
         for(rid = 0; rid < cmps; rid++) { // equal comparison
-          mask = compare_equal(features_[rid], key.str[plen + rid] + 128);
+          mask = compare_equal(features_[rid], key[plen + rid] + 128);
           mask = mask & eqmask;
           if(mask == 0) break;
           eqmask = mask;
         }
 
         if(rid < cmps) { // less comparison
-          mask = compare_less(features_[rid], key.str[plen + rid] + 128);
+          mask = compare_less(features_[rid], key[plen + rid] + 128);
           mask = mask & eqmask;
 
           // less than features corresponding to eqmask
@@ -1179,7 +1293,7 @@ class alignas(Config::kAlignSize) InnerNode<String> {
           if(control_.has_sibling()) to_sibling = true;
           assert(next != nullptr);
         } else {
-          next = children_[idx];
+          next = children()[idx];
           assert(next != nullptr);
         }
       }
@@ -1191,6 +1305,10 @@ class alignas(Config::kAlignSize) InnerNode<String> {
   }
 
   bool index_or_sibling(String& key, void*& next, int& index) {
+    return index_or_sibling(std::string_view(key.str, key.len), next, index);
+  }
+
+  bool index_or_sibling(std::string_view key, void*& next, int& index) {
     // move to sibling, return false; index key, return true;
     bool to_sibling = false;
 
@@ -1206,18 +1324,18 @@ class alignas(Config::kAlignSize) InnerNode<String> {
     if(!pcmp) { // prefix of key is equal to node prefix
       int rid, cmps, plen = plen_;
       uint64_t mask, eqmask = bitmap();
-      cmps = std::min(kFeatureSize, key.len - plen_);
-      DEBUG_COND_ERROR(key.len - plen_ < 0, "unknown error!");
+      cmps = std::min(kFeatureSize, (int) key.size() - plen_);
+      DEBUG_COND_ERROR((int) key.size() - plen_ < 0, "unknown error!");
 
       for(rid = 0; rid < cmps; rid++) {
-        mask = compare_equal(features_[rid], key.str[plen + rid] + 128);
+        mask = compare_equal(features_[rid], key[plen + rid] + 128);
         mask = mask & eqmask;
         if(mask == 0) break;
         eqmask = mask;
       }
 
       if(rid < cmps) { // less comparison
-        mask = compare_less(features_[rid], key.str[plen + rid] + 128);
+        mask = compare_less(features_[rid], key[plen + rid] + 128);
         mask = mask & eqmask;
 
         // less than features corresponding to eqmask
@@ -1252,19 +1370,19 @@ class alignas(Config::kAlignSize) InnerNode<String> {
 
     control_.update_version();
 
-    if(knum_ < kNodeSize) {  // safe, insert key into current node
+    if(knum_ < capacity()) {  // safe, insert key into current node
       if(kExtentOpt) key = make_anchor(epoch, key);
-      void* src = anchors_ + index;
-      void* dst = anchors_ + index + 1;
+      void* src = anchors() + index;
+      void* dst = anchors() + index + 1;
       memmove64(src, dst, knum_ - index, false);
-      anchors_[index] = key;
+      anchors()[index] = key;
 
       if(index != knum_) { // new node or rightmost node
-        src = children_ + index + 1;
-        dst = children_ + index + 2;
+        src = children() + index + 1;
+        dst = children() + index + 2;
         memmove64(src, dst, knum_ - index - 1, false);
-        children_[index + 1] = rchild;
-      } else { children_[index] = lchild, next_ = rchild; }
+        children()[index + 1] = rchild;
+      } else { children()[index] = lchild, next_ = rchild; }
 
       knum_ += 1;
       if(index == 0 || index == knum_ - 1) {
@@ -1291,12 +1409,12 @@ class alignas(Config::kAlignSize) InnerNode<String> {
     DEBUG_COND_ERROR(index < 0 || index >= knum_, "invalid index");
     control_.update_version(), up = false;
 
-    if(kExtentOpt) ruin_anchor(epoch, anchors_[index]);
+    if(kExtentOpt) ruin_anchor(epoch, anchors()[index]);
     if(index < knum_ - 1) {
       // knum is 2 at least, the merged node is in current node
       DEBUG_COND_ERROR(knum_ < 2, "knum equals 2 at least");
-      void* src = anchors_ + index + 1;
-      void* dst = anchors_ + index;
+      void* src = anchors() + index + 1;
+      void* dst = anchors() + index;
       memmove64(src, dst, knum_ - index - 1, true);
       if(index != 0) { // normal remove without the need to re-extract prefix
         for(int rid = 0; rid < kFeatureSize; rid++) {
@@ -1306,8 +1424,8 @@ class alignas(Config::kAlignSize) InnerNode<String> {
         }
       }
 
-      src = children_ + index + 2;
-      dst = children_ + index + 1;
+      src = children() + index + 2;
+      dst = children() + index + 1;
       memmove64(src, dst, knum_ - index - 2, true);
 
       knum_ -= 1; // knum >= 1
@@ -1327,9 +1445,9 @@ class alignas(Config::kAlignSize) InnerNode<String> {
 
     if(kExtentOpt) {
       key = make_anchor(epoch, key);
-      ruin_anchor(epoch, anchors_[index]);
+      ruin_anchor(epoch, anchors()[index]);
     }
-    anchors_[index] = key;
+    anchors()[index] = key;
     if(index == 0 || index == knum_ - 1) {
       content_rebuild();
     } else {
@@ -0,0 +1,183 @@
+#include <iostream>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <tuple>
+#include "fbtree.h"
+
+using namespace FeatureBTree;
+
+void check(bool cond, const char* what) {
+  if(!cond) {
+    std::cout << "check error: " << what << std::endl;
+    exit(-1);
+  }
+}
+
+// composite keys (int32, string, uint64) keep the tuple order in memcmp order
+void encoder_test(size_t nkey) {
+  typedef std::tuple<int32_t, std::string, uint64_t> Tuple;
+  std::mt19937_64 rng(nkey);
+  std::vector<Tuple> tuples;
+  std::vector<std::string> encoded;
+
+  std::cout << "-- encoder order ... " << std::flush;
+  const char* alphabet = "\0\x01\xFF" "ab"; // escaped, terminator-like and normal bytes
+  for(size_t i = 0; i < nkey; i++) {
+    std::string str;
+    for(int j = rng() % 4; j > 0; j--) str.push_back(alphabet[rng() % 5]);
+    tuples.emplace_back((int32_t) (rng() % 7) - 3, str, rng() % 3);
+  }
+  std::sort(tuples.begin(), tuples.end());
+  tuples.erase(std::unique(tuples.begin(), tuples.end()), tuples.end());
+  for(auto& [i, s, u] : tuples) encoded.push_back(KeyEncoder().append(i).append(s).append(u).str());
+  for(size_t i = 1; i < encoded.size(); i++)
+    check(encoded[i - 1] < encoded[i], "encoded keys are out of the tuple order");
+  std::cout << "end" << std::endl;
+
+  std::cout << "-- decoder round trip ... " << std::flush;
+  for(size_t i = 0; i < tuples.size(); i++) {
+    KeyDecoder decoder(encoded[i].data(), encoded[i].size());
+    check(decoder.read<int32_t>() == std::get<0>(tuples[i]), "decoded int32 column");
+    check(decoder.read_string() == std::get<1>(tuples[i]), "decoded string column");
+    check(decoder.read<uint64_t>() == std::get<2>(tuples[i]), "decoded uint64 column");
+    check(decoder.done(), "decoder has trailing bytes");
+  }
+  bool thrown = false;
+  try { KeyDecoder(encoded[0].data(), 2).read<int32_t>(); } catch(const std::out_of_range&) { thrown = true; }
+  check(thrown, "reading past the end doesn't throw");
+  thrown = false;
+  try { KeyEncoder().append("longer than eight").fixed<8>(); } catch(const std::length_error&) { thrown = true; }
+  check(thrown, "too long fixed key doesn't throw");
+  std::cout << "end" << std::endl;
+
+  std::cout << "-- encoded keys in tree ... " << std::flush;
+  FBTree<std::string, uint64_t> tree;
+  std::vector<size_t> order(encoded.size());
+  for(size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::shuffle(order.begin(), order.end(), rng);
+  for(size_t i : order) {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.upsert(encoded[i], i) == nullptr, "duplicate encoded key");
+  }
+  size_t n = 0;
+  {
+    EpochGuard epoch_guard(tree.get_epoch());
+    for(auto it = tree.begin(); !it.end(); it.advance(), n++)
+      check(n < encoded.size() && it->value == n, "scan is out of the tuple order");
+  }
+  check(n == encoded.size(), "scan misses encoded keys");
+  std::cout << "end" << std::endl;
+}
+
+// -inf < negatives < -0.0 == +0.0 < positives < +inf, in tree scans and encoded columns
+template<typename F>
+void float_test(size_t nkey) {
+  std::mt19937_64 rng(nkey);
+  std::vector<F> keys = {-std::numeric_limits<F>::infinity(), std::numeric_limits<F>::lowest(), F(-1.5),
+                         -std::numeric_limits<F>::denorm_min(), F(0), std::numeric_limits<F>::denorm_min(),
+                         F(1.5), std::numeric_limits<F>::max(), std::numeric_limits<F>::infinity()};
+  std::uniform_real_distribution<F> dist(-1e6, 1e6);
+  for(size_t i = 0; i < nkey; i++) keys.push_back(dist(rng));
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  std::cout << "-- float keys (" << sizeof(F) << " bytes) ... " << std::flush;
+  FBTree<F, uint64_t> tree;
+  std::vector<F> shuffled = keys;
+  std::shuffle(shuffled.begin(), shuffled.end(), rng);
+  for(F key : shuffled) {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.upsert(key == 0 ? -F(0) : key, (uint64_t) 1) == nullptr, "duplicate float key");
+  }
+  {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.lookup(F(0)) != nullptr, "+0.0 doesn't find -0.0");
+    KVPair<F, uint64_t>* old = tree.upsert(F(0), (uint64_t) 2);
+    check(old != nullptr, "+0.0 and -0.0 are different keys");
+    epoch_guard.retire(old);
+    size_t n = 0;
+    for(auto it = tree.begin(); !it.end(); it.advance(), n++)
+      check(n < keys.size() && it->key == keys[n], "float scan is out of order");
+    check(n == keys.size(), "float scan misses keys");
+  }
+  for(size_t i = 1; i < keys.size(); i++)
+    check(KeyEncoder().append(keys[i - 1]).str() < KeyEncoder().append(keys[i]).str(),
+          "encoded floats are out of order");
+  check(KeyEncoder().append(-F(0)).str() == KeyEncoder().append(F(0)).str(), "-0.0 isn't folded in encoded columns");
+  std::string zero = KeyEncoder().append(-F(0)).str();
+  check(!std::signbit(KeyDecoder(zero.data(), zero.size()).read<F>()), "-0.0 decodes with a sign");
+  bool thrown = false;
+  try { KeyEncoder().append(std::numeric_limits<F>::quiet_NaN()); } catch(const std::invalid_argument&) { thrown = true; }
+  check(thrown, "NaN column doesn't throw");
+  std::cout << "end" << std::endl;
+}
+
+// 16-byte keys differing in either 64-bit half, as uint128_t, FixedKey<16> and std::array<uint8_t, 16>
+void wide_test(size_t nkey) {
+  std::mt19937_64 rng(nkey);
+  std::vector<uint128_t> keys;
+  for(size_t i = 0; i < nkey; i++) {
+    uint128_t hi = rng() % 4, lo = rng() % 4 == 0 ? ~0ul - rng() % 4 : rng(); // ties and carries in each half
+    keys.push_back(hi << 64 | lo);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  std::vector<uint128_t> shuffled = keys;
+  std::shuffle(shuffled.begin(), shuffled.end(), rng);
+  auto to_array = [](uint128_t key) { // big-endian bytes, ordered as the integer
+    std::array<uint8_t, 16> bytes;
+    for(int i = 0; i < 16; i++) bytes[i] = (uint8_t) (key >> ((15 - i) * 8));
+    return bytes;
+  };
+
+  std::cout << "-- uint128 keys ... " << std::flush;
+  FBTree<uint128_t, uint64_t> tree;
+  for(uint128_t key : shuffled) {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.upsert(key, (uint64_t) 1) == nullptr, "duplicate uint128 key");
+  }
+  {
+    EpochGuard epoch_guard(tree.get_epoch());
+    size_t n = 0;
+    for(auto it = tree.begin(); !it.end(); it.advance(), n++)
+      check(n < keys.size() && it->key == keys[n], "uint128 scan is out of order");
+    check(n == keys.size(), "uint128 scan misses keys");
+  }
+  std::cout << "end" << std::endl;
+
+  std::cout << "-- 16-byte array keys ... " << std::flush;
+  FBTree<std::array<uint8_t, 16>, uint64_t> atree;
+  for(uint128_t key : shuffled) {
+    EpochGuard epoch_guard(atree.get_epoch());
+    check(atree.upsert(to_array(key), (uint64_t) 1) == nullptr, "duplicate array key");
+  }
+  {
+    EpochGuard epoch_guard(atree.get_epoch());
+    size_t n = 0;
+    for(auto it = atree.begin(); !it.end(); it.advance(), n++)
+      check(n < keys.size() && it->key.array() == to_array(keys[n]), "array scan is out of order");
+    check(n == keys.size(), "array scan misses keys");
+    for(size_t i = 0; i < keys.size(); i += 7) {
+      check(atree.lookup(to_array(keys[i])) != nullptr, "array key not found");
+      auto it = atree.lower_bound(to_array(keys[i]));
+      check(!it.end() && it->key == FixedKey<16>(to_array(keys[i])), "array lower bound");
+    }
+  }
+  std::cout << "end" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  if(argc < 2) {
+    std::cout << "-- nkey" << std::endl;
+    exit(-1);
+  }
+  size_t nkey = std::stoul(argv[1]);
+
+  std::cout << "-- key test: " << nkey << std::endl;
+  encoder_test(nkey);
+  float_test<float>(nkey);
+  float_test<double>(nkey);
+  wide_test(nkey);
+  return 0;
+}
@@ -12,9 +12,11 @@
 #include <cassert>
 #include <thread>
 #include <vector>
+#include <string_view>
 #include <tuple>
 #include <map>
 #include <algorithm>
+#include <type_traits>
 #include "config.h"
 #include "type.h"
 #include "constant.h"
@@ -24,6 +26,8 @@
 #include "common.h"
 #include "macro.h"
 #include "debug.h"
+#include "pager.h"
+#include "mvcc.h"
 
 namespace FeatureBTree {
 
@@ -36,20 +40,75 @@ using util::hash;
 using util::branch_likely;
 using util::branch_unlikely;
 
+/* member of an optional feature, accessed as f_[0] like a one-element array, a
+ * disabled one is empty and takes no space as a [[no_unique_address]] member,
+ * it must only be accessed under if constexpr of its feature */
+template<typename T, bool kEnabled>
+struct Optional {
+  T value_[1];
+
+  T& operator[](int i) { return value_[i]; }
+};
+
+template<typename T>
+struct Optional<T, false> {
+  T& operator[](int) {
+    assert(false);
+    return *(T*) this;
+  }
+};
+
 template<typename K, typename V>
 class alignas(Config::kAlignSize) LeafNode {
   static constexpr int kNodeSize = Constant<K>::kLeafSize;
   static constexpr int kMergeSize = Constant<K>::kLeafMergeSize;
+  static constexpr int kDeltaSize = Config::kDeltaSize;
+  static constexpr int kMaxClass = Config::kLeafClassOpt ? kNodeSize / 32 : 0; // at least 16 slots
   static constexpr std::memory_order load_order = std::memory_order_acquire;
   static constexpr std::memory_order store_order = std::memory_order_release;
   typedef util::KVPair<K, V> KVPair;
 
+  struct alignas(64) Delta {  // write-combining buffer of new kv pairs
+    std::atomic<bool> lock_;  // serialize appending and applying
+    std::atomic<int> count_;  // the number of buffered kv pairs
+    char tags_[kDeltaSize];
+    std::atomic<KVPair*> kvs_[kDeltaSize];
+
+    void lock() {
+      int spin = 0, limit = Config::kSpinInit;
+      while(lock_.exchange(true, std::memory_order_acquire)) {
+        if(spin++ >= limit) {
+          std::this_thread::yield();
+          spin = 0;
+        }
+      }
+    }
+
+    void unlock() { lock_.store(false, std::memory_order_release); }
+
+    std::atomic<KVPair*>* find(K key, char tag) {
+      int count = count_.load(std::memory_order_acquire);
+      for(int i = 0; i < count; i++) {
+        if(tags_[i] != tag) continue;
+        KVPair* kv = kvs_[i].load(std::memory_order_acquire);
+        // some other threads may be applying the delta buffer
+        if(kv != nullptr && key == kv->key) return kvs_ + i;
+      }
+      return nullptr;
+    }
+  };
+
   Control control_;       // synchronization, memory/compiler order
   uint64_t bitmap_;       // whether the corresponding kvs is used
   K high_key_;            // the upper bound of current node
   LeafNode* sibling_;     // right sibling or the node left after merge
+  [[no_unique_address]] Optional<std::atomic<Delta*>, Config::kDeltaOpt> delta_; // allocated once turning hot
+  [[no_unique_address]] Optional<std::atomic<uint64_t>, Config::kDirtyOpt> stamp_; // latest modifying generation
+  [[no_unique_address]] Optional<std::atomic<PageRef<K, V>*>, Config::kPagingOpt> page_; // paged out kv pairs
+  [[no_unique_address]] Optional<std::atomic<bool>, Config::kPagingOpt> referenced_; // accessed since last sweep
+  [[no_unique_address]] Optional<Undo<K, V>*, Config::kMvccOpt> undo_; // kvs before recent writes
   char tags_[kNodeSize];  // hashtags of the corresponding kvs.key
-  std::atomic<KVPair*> kvs_[kNodeSize];
+  std::atomic<KVPair*> kvs_[kNodeSize]; // the last member, truncated in small size classes
 
  private:
   uint64_t compare_equal(void* p, char c) {
@@ -61,15 +120,6 @@ class alignas(Config::kAlignSize) LeafNode {
       return compare_equal_16(p, c);
   }
 
-  constexpr uint64_t half_fill() {
-    if(kNodeSize == 64)
-      return 0xFFFF'FFFFul;
-    else if(kNodeSize == 32)
-      return 0xFFFFul;
-    else if(kNodeSize == 16)
-      return 0xFFul;
-  }
-
   constexpr int full_idx() {
     if(kNodeSize == 64)
       return -1;
@@ -86,7 +136,7 @@ class alignas(Config::kAlignSize) LeafNode {
     } else { return (0x01ul << size) - 1; }
   }
 
-  void merge(void*& merged, K& mid) {
+  void merge(void*& merged, K& mid, int merge_size) {
     DEBUG_COND_ERROR(merged != nullptr, "merged node is uninitialized");
     if(control_.has_sibling()) {  // only merge with the right sibling node
       LeafNode* rnode = sibling_;
@@ -94,11 +144,12 @@ class alignas(Config::kAlignSize) LeafNode {
       int lnkey = popcount(bitmap_);
       int rnkey = popcount(rnode->bitmap_);
       // if rnkey == 0 (the rightmost leaf), not merge immediately
-      if(lnkey + rnkey <= kMergeSize || lnkey == 0) { // try to merge
+      if(lnkey + rnkey <= merge_size || lnkey == 0) { // try to merge
         rnode->control_.latch_exclusive();
+        rnode->flush();
         rnkey = popcount(rnode->bitmap_);
         // ensure need to merge with right node
-        if(lnkey + rnkey <= kMergeSize || lnkey == 0) {
+        if(lnkey + rnkey <= merge_size || lnkey == 0) {
           merged = rnode;
           mid = encode_convert(high_key_);
 
@@ -116,6 +167,11 @@ class alignas(Config::kAlignSize) LeafNode {
             mask &= ~(0x01ul << ridx);
           }
           rnode->bitmap_ = 0;
+          if constexpr(Config::kMvccOpt) { // and the undo entries of its keys
+            Undo<K, V>** tail = &undo_[0];
+            while(*tail != nullptr) tail = &(*tail)->next_;
+            *tail = rnode->undo_[0], rnode->undo_[0] = nullptr;
+          }
 
           // set meta information
           high_key_ = rnode->high_key_;
@@ -137,14 +193,112 @@ class alignas(Config::kAlignSize) LeafNode {
   KVPair* access(int pos) {
     if(pos < 0 || pos >= kNodeSize) return nullptr;
     uint64_t mask = 0x01ul << pos;
-    if(mask & bitmap_ == 0) return nullptr;
+    if((mask & bitmap_) == 0) return nullptr;
     return kvs_[pos].load(load_order);
   }
 
+  Delta* delta() {
+    if constexpr(Config::kDeltaOpt) return delta_[0].load(load_order);
+    else return nullptr;
+  }
+
+  PageRef<K, V>* page() {
+    if constexpr(Config::kPagingOpt) return page_[0].load(load_order);
+    else return nullptr;
+  }
+
+  // mark current node recently accessed for the clock sweep, written only if clear
+  void reference() {
+    if constexpr(Config::kPagingOpt) {
+      if(!referenced_[0].load(std::memory_order_relaxed)) referenced_[0].store(true, std::memory_order_relaxed);
+    }
+  }
+
+  /* read the kv pairs paged out back into their slots, current node must be
+   * latched; the bitmap and tags stay while paged out, so they are slot exact */
+  void load_page() {
+    PageRef<K, V>* ref = page();
+    if(ref == nullptr) return;
+    constexpr size_t kRecord = sizeof(K) + sizeof(V);
+    std::vector<char> data(popcount(bitmap_) * kRecord);
+    ref->pager_->read(ref->page_, data.data(), data.size());
+
+    const char* record = data.data();
+    uint64_t mask = bitmap_;
+    while(mask) {
+      int idx = index_least1(mask);
+      KVPair* kv = (KVPair*) malloc(sizeof(KVPair));
+      memcpy((void*) &kv->key, record, sizeof(K));
+      memcpy((void*) &kv->value, record + sizeof(K), sizeof(V));
+      kvs_[idx].store(kv, store_order);
+      record += kRecord;
+      mask &= ~(0x01ul << idx);
+    }
+    page_[0].store(nullptr, store_order);
+    delete ref;
+    control_.update_version(); // inform lookup threads that read null kvs
+  }
+
+  // load the page of current node for an unlatched operation
+  void fault() {
+    control_.latch_exclusive();
+    load_page();
+    control_.unlatch_exclusive();
+  }
+
+  // apply buffered kv pairs to current node, current node must be latched
+  void flush() {
+    load_page(); // paged out kv pairs first
+    Delta* delta = this->delta();
+    if(delta == nullptr) return;
+
+    delta->lock();
+    int count = delta->count_.load(load_order);
+    if(count > 0) {
+      control_.update_version(); // inform lookup threads, one version for all kv pairs
+      for(int i = 0; i < count; i++) {
+        int idx = index_least0(bitmap_); // appending ensures enough empty slots
+        tags_[idx] = delta->tags_[i];
+        // using exchange, because other update operations may happen concurrently
+        KVPair* kv = delta->kvs_[i].exchange(nullptr);
+        kvs_[idx].store(kv, store_order);
+        bitmap_ |= (0x01ul << idx);
+      }
+      delta->count_.store(0, store_order);
+    }
+    delta->unlock();
+  }
+
  public:
-  LeafNode() : control_(true), bitmap_(0), high_key_(0), sibling_(nullptr) {}
+  explicit LeafNode(int size_class = 0)
+    : control_(true, size_class), bitmap_(0), high_key_(), sibling_(nullptr) {
+    if constexpr(Config::kDeltaOpt) delta_[0].store(nullptr, store_order);
+    if constexpr(Config::kDirtyOpt) stamp_[0].store(0, store_order);
+    if constexpr(Config::kPagingOpt) {
+      page_[0].store(nullptr, store_order);
+      referenced_[0].store(false, store_order);
+    }
+    if constexpr(Config::kMvccOpt) undo_[0] = nullptr;
+  }
 
   ~LeafNode() {
+    if constexpr(Config::kMvccOpt) prune_undo(UINT64_MAX);
+
+    if(Delta* delta = this->delta()) {
+      for(int i = 0; i < delta->count_.load(load_order); i++) {
+        KVPair* kv = delta->kvs_[i].load(load_order);
+        kv->~KVPair();
+        free(kv);
+      }
+      free(delta);
+    }
+
+    if(PageRef<K, V>* ref = page()) { // kv pairs paged out are not allocated
+      ref->pager_->release(ref->page_);
+      delete ref;
+      return;
+    }
+
     uint64_t mask = bitmap_;
     while(mask) {
       int idx = index_least1(mask);
@@ -161,10 +315,70 @@ class alignas(Config::kAlignSize) LeafNode {
     return nullptr;
   }
 
+  // the delta buffer of current node, retired with current node once merged
+  void* delta_buffer() { return delta(); }
+
+  // memory size of a leaf node of the size class, the tail of kvs_ is not allocated
+  static size_t node_size(int size_class) {
+    return sizeof(LeafNode) - (kNodeSize - (kNodeSize >> size_class)) * sizeof(std::atomic<KVPair*>);
+  }
+
+  // the size class of the fewest slots, a new tree starts with a root leaf node of it
+  static constexpr int max_class() { return kMaxClass; }
+
+  int size_class() { return control_.size_class(); }
+
+  /* the size class current node should be resized to, current node must be
+   * latched: the next larger class if full, the smallest class with at least
+   * twice as many slots as keys if at most a quarter full, otherwise its own */
+  int fit_class() {
+    flush(); // buffered kv pairs first
+    int size_class = control_.size_class(), nkey = popcount(bitmap_);
+    if(size_class > 0 && nkey >= (kNodeSize >> size_class)) return size_class - 1;
+    if(size_class < kMaxClass && nkey * 4 <= (kNodeSize >> size_class)) {
+      while(size_class < kMaxClass && nkey * 2 <= (kNodeSize >> (size_class + 1)))
+        size_class += 1;
+    }
+    return size_class;
+  }
+
+  /* move all kv pairs and meta information into node, a new leaf node of another
+   * size class, both must be latched; current node is deleted like a merged node,
+   * its sibling_ points to node, so concurrent threads move to node */
+  void resize(LeafNode* node) {
+    flush(); // buffered kv pairs first
+    int nkey = 0;
+    uint64_t mask = bitmap_;
+    while(mask) {
+      int idx = index_least1(mask);
+      node->tags_[nkey] = tags_[idx];
+      // using exchange, because other update operations may happen concurrently
+      KVPair* kv = kvs_[idx].exchange(nullptr); // get the latest value, and set it to null
+      node->kvs_[nkey++].store(kv, store_order);
+      mask &= ~(0x01ul << idx);
+    }
+    DEBUG_COND_ERROR(nkey > (kNodeSize >> node->size_class()), "resize error");
+    node->bitmap_ = bitmap(nkey);
+    node->high_key_ = high_key_;
+    node->sibling_ = sibling_;
+    if(control_.has_sibling()) node->control_.set_sibling();
+    if constexpr(Config::kMvccOpt) node->undo_[0] = undo_[0], undo_[0] = nullptr;
+
+    bitmap_ = 0;
+    sibling_ = node;
+    control_.set_delete();
+    control_.update_version(); // inform lookup thread
+  }
+
   void statistic(std::map<std::string, double>& stat) {
-    stat["index size"] += sizeof(LeafNode);
+    stat["index size"] += node_size(control_.size_class());
+    if(delta() != nullptr) stat["index size"] += sizeof(Delta);
     stat["leaf num"] += 1;
     stat["kv pair num"] += popcount(bitmap_);
+    if(page() != nullptr) stat["paged leaf num"] += 1;
+    if constexpr(Config::kMvccOpt) {
+      for(Undo<K, V>* undo = undo_[0]; undo != nullptr; undo = undo->next_) stat["undo num"] += 1;
+    }
   }
 
   func_used void exhibit() {
@@ -202,8 +416,12 @@ class alignas(Config::kAlignSize) LeafNode {
     return false;
   }
 
-  // lookup can be executed concurrently with lookup, update, upsert, remove, sort
-  KVPair* lookup(K key) { // key must be normal encoding form
+  /* lookup can be executed concurrently with lookup, update, upsert, remove, sort;
+   * without faulting, a paged out node reads null kvs, the caller validates the
+   * version (paging it out changed it) */
+  KVPair* lookup(K key, bool faulting = true) { // key must be normal encoding form
+    if(Config::kPagingOpt && faulting && branch_unlikely(page() != nullptr)) fault();
+    reference();
     char tag = hash(key); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
 
@@ -215,11 +433,18 @@ class alignas(Config::kAlignSize) LeafNode {
       mask &= ~(0x01ul << idx);
     }
 
+    if(Delta* delta = this->delta()) { // new kv pairs may be buffered
+      std::atomic<KVPair*>* slot = delta->find(key, tag);
+      if(slot != nullptr) return slot->load(load_order);
+    }
+
     return nullptr;
   }
 
   // update can be executed concurrently with update, lookup, upsert, remove, sort
   KVPair* update(KVPair* kv) {
+    if(Config::kPagingOpt && branch_unlikely(page() != nullptr)) fault();
+    reference();
     char tag = hash(kv->key); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
 
@@ -244,17 +469,95 @@ class alignas(Config::kAlignSize) LeafNode {
       mask &= ~(0x01ul << idx);
     }
 
+    if(Delta* delta = this->delta()) { // new kv pairs may be buffered
+      std::atomic<KVPair*>* slot = delta->find(kv->key, tag);
+      if(slot != nullptr) {
+        KVPair* old = slot->load(load_order);
+        while(old != nullptr && kv->key == old->key) {
+          if(slot->compare_exchange_strong(old, kv)) return old;
+        }
+      }
+    }
+
     // failed because other threads' upsert or remove (version has changed)
     // failed because other threads' sort (version has changed)
     // failed because the key doesn't exist
     return nullptr;
   }
 
+  /* latch of current node was contended, current node must be latched,
+   * allocate a delta buffer once current node turns hot */
+  void heat_up() {
+    if constexpr(Config::kDeltaOpt) {
+      if(control_.heat_up() && delta() == nullptr) {
+        void* delta = malloc(sizeof(Delta));
+        memset(delta, 0, sizeof(Delta));
+        delta_[0].store((Delta*) delta, store_order);
+      }
+    }
+  }
+
+  /* halve the heat of current node, current node must be latched, a node no
+   * longer hot drops its delta buffer, which is returned to be retired */
+  void* cool_down() {
+    if constexpr(Config::kDeltaOpt) {
+      control_.cool_down();
+      Delta* delta = this->delta();
+      if(delta == nullptr || control_.heat() == 7) return nullptr;
+      flush(); // buffered kv pairs first
+      delta->lock();
+      delta_[0].store(nullptr, store_order);
+      control_.update_version(); // appenders holding the buffer fail to validate
+      delta->unlock();
+      return delta;
+    }
+    return nullptr;
+  }
+
+  /* append a new kv to the delta buffer without latching current node, version
+   * is the version of current node when to_sibling returns false, return false
+   * if current node is not hot, or the delta buffer is full, or version changed,
+   * then the caller should upsert kv with the latch of current node */
+  bool append(KVPair* kv, KVPair*& old, uint64_t version) {
+    Delta* delta = this->delta();
+    if(delta == nullptr) return false;
+    // the key has already existed
+    if((old = update(kv)) != nullptr) return true;
+
+    char tag = hash(kv->key); // finger print generation
+    bool appended = false;
+    delta->lock();
+    // other threads may have appended the key
+    std::atomic<KVPair*>* slot = delta->find(kv->key, tag);
+    if(slot != nullptr) {
+      old = slot->exchange(kv);
+      appended = true;
+    } else {
+      /* current node has not been modified since the key was not found, any
+       * writer latching it afterwards applies the delta buffer first, which
+       * waits for us, so the key is never lost or duplicated; scan must sort
+       * current node before accessing it by pos, so the order bit is cleared
+       * along with the validation */
+      int count = delta->count_.load(load_order);
+      if(count < kDeltaSize && popcount(bitmap_) + count < (kNodeSize >> control_.size_class()) &&
+         control_.validate_unorder(version)) {
+        delta->tags_[count] = tag;
+        delta->kvs_[count].store(kv, store_order);
+        delta->count_.store(count + 1, store_order);
+        old = nullptr, appended = true;
+      }
+    }
+    delta->unlock();
+
+    return appended;
+  }
+
   // upsert can be executed concurrently with lookup, update
-  KVPair* upsert(KVPair* kv, void*& rnode, K& mid) {
-    /* if the key has already existed, update it and return the old kv pointer,
-     * otherwise successfully insert the ky, and return a nullptr, mid must be
-     * converted to suitable encoding form before return */
+  KVPair* upsert(KVPair* kv, void*& rnode, K& mid, bool overwrite = true) {
+    /* if the key has already existed, update it (unless !overwrite) and return the
+     * old kv pointer, otherwise successfully insert the ky, and return a nullptr,
+     * mid must be converted to suitable encoding form before return */
+    flush(); // buffered kv pairs first
     rnode = nullptr; // update or normal insert
     char tag = hash(kv->key); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
@@ -265,23 +568,28 @@ class alignas(Config::kAlignSize) LeafNode {
       KVPair* old = kvs_[idx].load(load_order);
       // old can't be nullptr, must be a valid pointer
       if(kv->key == old->key) {
+        if(!overwrite) return kvs_[idx].load(load_order);
         // using exchange, because other update operations may happen concurrently
         return kvs_[idx].exchange(kv); // get the latest value, and set it to kv
       }
       mask &= ~(0x01ul << idx);
     }
 
-    control_.update_version();  // it has been confirmed that we need to insert the key
-    // into current node even split the node, update node's version, don't need to update
-    // the right node's version, because other threads can't access the right node now
+    LeafNode* node = this;
+    int last = control_.last_insert(); // the split hint, before it is overwritten
+    idx = index_least0(bitmap_); // find an empty slot
+    // it has been confirmed that we need to insert the key into current node even split the
+    // node, update node's version (and record the slot of the latest insert), don't need to
+    // update the right node's version, because other threads can't access the right node now
+    control_.update_version(idx == full_idx() ? -1 : idx);
 
     // if kv pairs were originally ordered, to insert a new kv (whether
     // to split or not) will result in unordered kv pairs, in most cases
     // and the new sibling will be initialized with unordered flag
     if(control_.ordered()) control_.clear_order();
 
-    LeafNode* node = this;
-    idx = index_least0(bitmap_); // find an empty slot
+    // only the root leaf node may be of a small size class, resized before it is full
+    DEBUG_COND_ERROR(idx != full_idx() && idx >= (kNodeSize >> control_.size_class()), "small leaf node overflow");
     //if idx != full_idx, the node has an empty slot
     if(idx == full_idx()) { // full, need split
       // phase 1, keys sorting
@@ -311,9 +619,15 @@ class alignas(Config::kAlignSize) LeafNode {
         high_key_ = keys.back().first;
         control_.set_sibling();
       } else {
-        // normal split, move half key-value pairs to the new node
+        // normal split, move half (or less/more, if skewed) key-value pairs to the new node
+        auto lower = [&](std::pair<K, int>& a) { return a.first < kv->key; };
+        int pos = std::partition_point(keys.begin(), keys.end(), lower) - keys.begin();
+        // the key lands right after/before the latest inserted key
+        bool clustered = last >= 0 && ((pos > 0 && keys[pos - 1].second == last) ||
+                                       (pos < kNodeSize && keys[pos].second == last));
+        int half = split_point(pos, kNodeSize, clustered);
         mask = 0x00ul;  // clear mask, mark keys moved to right node
-        int i = kNodeSize / 2, rid = 0, lid;
+        int i = half, rid = 0, lid;
         for(; i < kNodeSize; i++, rid++) {
           lid = keys[i].second;
           mask |= (0x01ul << lid);
@@ -326,26 +640,37 @@ class alignas(Config::kAlignSize) LeafNode {
         }
 
         /* set corresponding variables before setting flag */
-        ((LeafNode*) rnode)->bitmap_ = half_fill();
+        ((LeafNode*) rnode)->bitmap_ = bitmap(kNodeSize - half);
         ((LeafNode*) rnode)->sibling_ = sibling_;
         ((LeafNode*) rnode)->high_key_ = high_key_;
 
-        DEBUG_COND_ERROR(popcount(mask) != kNodeSize / 2, "split error");
+        DEBUG_COND_ERROR(popcount(mask) != kNodeSize - half, "split error");
         bitmap_ &= ~mask;  // remove keys in leaf node
-        DEBUG_COND_ERROR(popcount(bitmap_) != kNodeSize / 2, "split error");
+        DEBUG_COND_ERROR(popcount(bitmap_) != half, "split error");
         sibling_ = (LeafNode*) rnode;
-        high_key_ = keys[kNodeSize / 2 - 1].first;
+        high_key_ = keys[half - 1].first;
 
         if(!control_.has_sibling()) control_.set_sibling();
         else ((LeafNode*) rnode)->control_.set_sibling();
 
         if(kv->key > high_key_) {
-          idx = kNodeSize / 2;
+          idx = kNodeSize - half;
           node = (LeafNode*) rnode;
         } else { idx = lid; } // less than high key, select an empty slot in left node
       }
+      node->control_.set_last_insert(idx); // the slot the key lands in after splitting
 
       mid = encode_convert(high_key_);
+      if constexpr(Config::kMvccOpt) { // undo entries follow their keys
+        Undo<K, V>** link = &undo_[0];
+        while(Undo<K, V>* undo = *link) {
+          if(high_key_ < undo->key_) {
+            *link = undo->next_;
+            undo->next_ = ((LeafNode*) rnode)->undo_[0];
+            ((LeafNode*) rnode)->undo_[0] = undo;
+          } else { link = &undo->next_; }
+        }
+      }
     }
 
     DEBUG_COND_ERROR((node->bitmap_ & (0x01ul << idx)) != 0, "insert error");
@@ -358,9 +683,17 @@ class alignas(Config::kAlignSize) LeafNode {
   }
 
   // remove can be executed concurrently with lookup, update
-  KVPair* remove(K key, void*& mnode, K& mid) { // mnode: merged node
+  KVPair* remove(K key, void*& mnode, K& mid, bool lazy) { // mnode: merged node
+    return remove(key, mnode, mid, lazy, [](KVPair*) { return true; });
+  }
+
+  template<typename P>
+  KVPair* remove(K key, void*& mnode, K& mid, bool lazy, P&& pred) {
     /* key must be normal encoding form, return the old kv (or nullptr),
-     * mid must be converted to suitable encoding form before return */
+     * mid must be converted to suitable encoding form before return,
+     * lazy: leave merge to the maintenance thread (merge_sibling),
+     * the kv is removed only if pred(kv) */
+    flush(); // buffered kv pairs first
     mnode = nullptr; // normal remove without merge operation
     char tag = hash(key); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
@@ -370,11 +703,14 @@ class alignas(Config::kAlignSize) LeafNode {
       KVPair* kv = kvs_[idx].load(load_order);
       // kv can't be nullptr, must be a valid pointer
       if(kv->key == key) {
-        control_.update_version(); // key exists, update node version
+        // using compare_exchange, because other update operations may happen concurrently
+        do {
+          if(!pred(kv)) return nullptr;
+        } while(!kvs_[idx].compare_exchange_weak(kv, nullptr)); // set the latest value to null
+        int last = control_.last_insert();
+        control_.update_version(last == idx ? -1 : last); // key exists, update node version
         bitmap_ &= ~(0x01ul << idx); // update bitmap
-        // using exchange, because other update operations may happen concurrently
-        kv = kvs_[idx].exchange(nullptr); // get the latest value, and set it to null
-        merge(mnode, mid);  // try to merge with sibling
+        if(!lazy) merge(mnode, mid, kMergeSize);  // try to merge with sibling
 
         // normal remove kv from a node never change the order, only if to merge current node
         // with its sibling, the order may change; however normal remove results in kv pairs
@@ -389,10 +725,215 @@ class alignas(Config::kAlignSize) LeafNode {
     return nullptr; // key does not exist
   }
 
+  // current node and its sibling may be merged, a hint without latch
+  bool underfull(int merge_size = kMergeSize) {
+    if(!control_.has_sibling() || control_.deleted()) return false;
+    int lnkey = popcount(bitmap_), rnkey = popcount(sibling_->bitmap_);
+    return lnkey + rnkey <= merge_size || lnkey == 0;
+  }
+
+  K high_key() { return high_key_; }
+
+  // the slot holding the kv of key, or null if absent, current node must be latched
+  std::atomic<KVPair*>* slot(K key) {
+    flush(); // buffered kv pairs first
+    reference();
+    char tag = hash(key); // finger print generation
+    uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
+    while(mask) {
+      int idx = index_least1(mask);
+      // kv can't be nullptr, must be a valid pointer
+      if(kvs_[idx].load(load_order)->key == key) return kvs_ + idx;
+      mask &= ~(0x01ul << idx);
+    }
+    return nullptr;
+  }
+
+  // the number of kv pairs, buffered ones included, read optimistically
+  int size() {
+    Delta* delta = this->delta();
+    return popcount(bitmap_) + (delta == nullptr ? 0 : delta->count_.load(load_order));
+  }
+
+  // the number of keys satisfying in(key), read optimistically, see FBTree::count_range
+  template<typename F>
+  int count(F&& in) {
+    int n = 0;
+    visit([&](KVPair* kv) { n += in(kv->key); });
+    return n;
+  }
+
+  // fn(kv) for kv pairs in bitmap order (unsorted), buffered ones last, read optimistically
+  template<typename F>
+  void visit(F&& fn) {
+    if(Config::kPagingOpt && branch_unlikely(page() != nullptr)) fault();
+    uint64_t mask = bitmap_;
+    while(mask) {
+      int idx = index_least1(mask);
+      KVPair* kv = kvs_[idx].load(load_order);
+      // some other threads may be splitting or removing or sorting
+      if(kv != nullptr) fn(kv);
+      mask &= ~(0x01ul << idx);
+    }
+    if(Delta* delta = this->delta()) { // new kv pairs may be buffered
+      int count = delta->count_.load(load_order);
+      for(int i = 0; i < count; i++) {
+        KVPair* kv = delta->kvs_[i].load(load_order);
+        if(kv != nullptr) fn(kv);
+      }
+    }
+  }
+
+  // current node is modified in the checkpoint generation gen, see FBTree::checkpoint_incremental
+  void touch(uint64_t gen) {
+    if constexpr(Config::kDirtyOpt) {
+      if(stamp_[0].load(std::memory_order_relaxed) < gen) stamp_[0].store(gen, std::memory_order_relaxed);
+    }
+  }
+
+  // the latest generation modifying current node, every node is dirty without tracking
+  uint64_t stamp() {
+    if constexpr(Config::kDirtyOpt) return stamp_[0].load(std::memory_order_relaxed);
+    else return UINT64_MAX;
+  }
+
+  // append kv pairs whose keys are greater than low (if has_low) to kvs, current node must be latched
+  void collect(std::vector<KVPair*>& kvs, bool has_low, K low) {
+    flush(); // buffered kv pairs first
+    uint64_t mask = bitmap_;
+    while(mask) {
+      int idx = index_least1(mask);
+      KVPair* kv = kvs_[idx].load(load_order);
+      if(!has_low || low < kv->key) kvs.push_back(kv);
+      mask &= ~(0x01ul << idx);
+    }
+  }
+
+  bool has_undo() {
+    if constexpr(Config::kMvccOpt) return undo_[0] != nullptr;
+    else return false;
+  }
+
+  // keep the kv before a write, current node must be latched
+  void push_undo(Undo<K, V>* undo) {
+    if constexpr(Config::kMvccOpt) undo->next_ = undo_[0], undo_[0] = undo;
+  }
+
+  // free undo entries of writes at or before floor, current node must be latched
+  void prune_undo(uint64_t floor) {
+    if constexpr(Config::kMvccOpt) {
+      Undo<K, V>** link = &undo_[0];
+      while(Undo<K, V>* undo = *link) {
+        if(undo->ts_ <= floor) {
+          *link = undo->next_;
+          delete undo;
+        } else { link = &undo->next_; }
+      }
+    }
+  }
+
+  /* append kv pairs of current node as of the snapshot ts whose keys are greater
+   * than low (if has_low) to kvs, current node must be latched: the current kv of
+   * a key is replaced by the kv before its earliest write after ts, and keys
+   * removed after ts come back from their undo entries */
+  void collect(std::vector<KVPair*>& kvs, bool has_low, K low, uint64_t ts) {
+    size_t first = kvs.size();
+    collect(kvs, has_low, low);
+    if constexpr(Config::kMvccOpt) {
+      std::map<K, Undo<K, V>*> earliest;
+      for(Undo<K, V>* undo = undo_[0]; undo != nullptr; undo = undo->next_) {
+        if(undo->ts_ <= ts || (has_low && !(low < undo->key_))) continue;
+        auto [it, inserted] = earliest.emplace(undo->key_, undo);
+        if(!inserted && undo->ts_ < it->second->ts_) it->second = undo;
+      }
+      if(earliest.empty()) return;
+
+      size_t end = first;
+      for(size_t i = first; i < kvs.size(); i++) {
+        auto it = earliest.find(kvs[i]->key);
+        if(it == earliest.end()) { kvs[end++] = kvs[i]; continue; }
+        if(it->second->kv_ != nullptr) kvs[end++] = it->second->kv_; // null: inserted after ts
+        earliest.erase(it);
+      }
+      kvs.resize(end);
+      for(auto& [key, undo] : earliest) // removed after ts
+        if(undo->kv_ != nullptr) kvs.push_back(undo->kv_);
+    }
+  }
+
+  bool paged() { return page() != nullptr; }
+
+  // read the kv pairs back if paged out, current node must be latched (fault latches it)
+  void page_in() { if(Config::kPagingOpt && branch_unlikely(page() != nullptr)) load_page(); }
+
+  // like page_in, but latches current node, so it is called before an optimistic read section
+  void fault_in() { if(Config::kPagingOpt && branch_unlikely(page() != nullptr)) fault(); }
+
+  // clear the referenced bit, return whether current node was accessed since the last sweep
+  bool unreference() {
+    if constexpr(Config::kPagingOpt) return referenced_[0].exchange(false, std::memory_order_relaxed);
+    else return false;
+  }
+
+  /* write kv pairs to a page of pager and release them, current node must be
+   * latched; the kvs are moved into retired for the epoch reclaimer, unlatched
+   * readers holding them stay safe, and readers finding null kvs retry on the
+   * version and fault the page in; return false if nothing is paged out, or if
+   * the page write fails and the kv pairs stay resident */
+  bool page_out(Pager<K, V>* pager, std::vector<KVPair*>& retired) {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>);
+    if(page() != nullptr) return false;
+    kv_sort(); // ordered, so the maintenance never faults it in to sort
+    if(bitmap_ == 0) return false;
+
+    constexpr size_t kRecord = sizeof(K) + sizeof(V);
+    std::vector<char> data(popcount(bitmap_) * kRecord);
+    std::vector<KVPair*> kvs;
+    char* record = data.data();
+    uint64_t mask = bitmap_;
+    while(mask) {
+      int idx = index_least1(mask);
+      // using exchange, because other update operations may happen concurrently
+      KVPair* kv = kvs_[idx].exchange(nullptr); // get the latest value, and set it to null
+      memcpy(record, &kv->key, sizeof(K));
+      memcpy(record + sizeof(K), &kv->value, sizeof(V));
+      kvs.push_back(kv);
+      record += kRecord;
+      mask &= ~(0x01ul << idx);
+    }
+    uint64_t id;
+    if(!pager->write(data.data(), data.size(), id)) { // keep the kv pairs resident
+      mask = bitmap_;
+      for(KVPair* kv : kvs) {
+        int idx = index_least1(mask);
+        kvs_[idx].store(kv, store_order);
+        mask &= ~(0x01ul << idx);
+      }
+      control_.update_version(); // inform lookup threads that read null kvs
+      return false;
+    }
+    retired.insert(retired.end(), kvs.begin(), kvs.end());
+    page_[0].store(new PageRef<K, V>{pager, id}, store_order);
+    control_.update_version(); // inform lookup threads
+    return true;
+  }
+
+  // merge with the right sibling node if underfull, current node must be latched
+  void merge_sibling(void*& mnode, K& mid, int merge_size) {
+    mnode = nullptr;
+    flush(); // buffered kv pairs first
+    merge(mnode, mid, merge_size);
+    if(mnode != nullptr) {
+      control_.update_version(); // kvs of the sibling are moved in
+      if(control_.ordered()) control_.clear_order();
+    }
+  }
+
   // sort kv pairs, current node need to be latched like remove/upsert,executed concurrently with lookup, update
   // lookup/update never change the order of kv pairs in current node, so the ordered flag never changed
   // upsert/remove may change the order of kv pairs in current node, note modification of the ordered flag
   void kv_sort() {
+    flush(); // buffered kv pairs first
     if(!control_.ordered()) {
       char tags[kNodeSize];
       std::vector<std::pair<KVPair*, int>> keys;
@@ -414,21 +955,25 @@ class alignas(Config::kAlignSize) LeafNode {
       };
       std::sort(keys.begin(), keys.end(), less);
 
+      int last = control_.last_insert(), sorted_last = -1; // the latest insert moves too
       for(int idx = 0; idx < keys.size(); idx++) {
         auto [kv, pos] = keys[idx];
         tags[idx] = tags_[pos];
         kvs_[idx].store(kv, store_order);
+        if(pos == last) sorted_last = idx;
       }
       memcpy(tags_, tags, kNodeSize);
       bitmap_ = bitmap(keys.size());
 
       control_.set_order();
-      control_.update_version();
+      control_.update_version(sorted_last);
     }
   }
 
+  // a paged out node reads null kvs, the caller checks paged() in its read section or latches it
   std::pair<KVPair*, int> bound(K key, bool upper) {
     // true for upper_bound, false for lower_bound
+    reference();
     // first try to search the key in current node
     int nkey = popcount(bitmap_);
     char tag = hash(key); // finger print generation
@@ -441,7 +986,7 @@ class alignas(Config::kAlignSize) LeafNode {
       if(kv != nullptr && key == kv->key) {
         // find the key in current node
         if(upper) {
-          if(idx + 1 >= nkey) std::make_pair(nullptr, 0);
+          if(idx + 1 >= nkey) return std::make_pair(nullptr, 0);
           kv = kvs_[idx + 1].load(load_order);
           return std::make_pair(kv, idx + 1);
         }
@@ -471,18 +1016,20 @@ class alignas(Config::kAlignSize) LeafNode {
   }
 
   auto access(KVPair* kv, int pos, uint64_t version) {
+    reference();
     // in most cases, kvs are ordered, access kv by pos first
     KVPair* next;
-    if(control_.ordered()) {
+    // the caller faults the page in before its read section, a paged out node is read latched
+    if(control_.ordered() && !(Config::kPagingOpt && branch_unlikely(paged()))) {
       next = access(pos);
       // if kvs are ordered, and version hasn't changed
       if(control_.end_read(version))
         return std::tuple(next, pos, version);
     }
 
-    // kvs are unordered or version has changed
+    // kvs are unordered or paged out or version has changed
     control_.latch_exclusive();
-    kv_sort(); // sort kvs
+    kv_sort(); // sort kvs, paged out kvs are read back first
     // kv is valid, get the next kv pair by bound
     if(kv != nullptr) {
       std::tie(next, pos) = bound(kv->key, true);
@@ -500,6 +1047,7 @@ template<typename V>
 class alignas(Config::kAlignSize) LeafNode<String, V> {
   static constexpr int kNodeSize = Constant<String>::kLeafSize;
   static constexpr int kMergeSize = Constant<String>::kLeafMergeSize;
+  static constexpr int kMaxClass = Config::kLeafClassOpt ? kNodeSize / 32 : 0; // at least 16 slots
   static constexpr std::memory_order load_order = std::memory_order_acquire;
   static constexpr std::memory_order store_order = std::memory_order_release;
   typedef util::KVPair<String, V> KVPair;
@@ -521,15 +1069,6 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
       return compare_equal_16(p, c);
   }
 
-  constexpr uint64_t half_fill() {
-    if(kNodeSize == 64)
-      return 0xFFFF'FFFFul;
-    else if(kNodeSize == 32)
-      return 0xFFFFul;
-    else if(kNodeSize == 16)
-      return 0xFFul;
-  }
-
   constexpr int full_idx() {
     if(kNodeSize == 64)
       return -1;
@@ -539,6 +1078,10 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
       return 16;
   }
 
+  static bool key_less(String& k1, String& k2) {
+    return key_compare(k1.str, k1.len, k2.str, k2.len) < 0;
+  }
+
   uint64_t bitmap(int size) {
     if(kNodeSize == 64) { // avoid undefined behavior in shift operation
       if(size == kNodeSize) { return 0x00ul - 1; }
@@ -546,7 +1089,7 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
     } else { return (0x01ul << size) - 1; }
   }
 
-  void merge(void*& merged, String*& mid) {
+  void merge(void*& merged, String*& mid, int merge_size) {
     DEBUG_COND_ERROR(merged != nullptr, "merged node is uninitialized");
     if(control_.has_sibling()) {  // only merge with the right sibling node
       LeafNode* rnode = sibling_;
@@ -554,11 +1097,11 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
       int lnkey = popcount(bitmap_);
       int rnkey = popcount(rnode->bitmap_);
       // if rnkey == 0 (the rightmost leaf), not merge immediately
-      if(lnkey + rnkey <= kMergeSize || lnkey == 0) { // try to merge
+      if(lnkey + rnkey <= merge_size || lnkey == 0) { // try to merge
         rnode->control_.latch_exclusive();
         rnkey = popcount(rnode->bitmap_);
         // ensure need to merge with right node
-        if(lnkey + rnkey <= kMergeSize || lnkey == 0) {
+        if(lnkey + rnkey <= merge_size || lnkey == 0) {
           merged = rnode, mid = high_key_;
 
           // move kvs in sibling to current node
@@ -596,12 +1139,13 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
   KVPair* access(int pos) {
     if(pos < 0 || pos >= kNodeSize) return nullptr;
     uint64_t mask = 0x01ul << pos;
-    if(mask & bitmap_ == 0) return nullptr;
+    if((mask & bitmap_) == 0) return nullptr;
     return kvs_[pos].load(load_order);
   }
 
  public:
-  LeafNode() : control_(true), bitmap_(0), high_key_(nullptr), sibling_(nullptr) {}
+  explicit LeafNode(int size_class = 0)
+    : control_(true, size_class), bitmap_(0), high_key_(nullptr), sibling_(nullptr) {}
 
   ~LeafNode() {
     uint64_t mask = bitmap_;
@@ -623,8 +1167,57 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
     return nullptr;
   }
 
+  // memory size of a leaf node of the size class, the tail of kvs_ is not allocated
+  static size_t node_size(int size_class) {
+    return sizeof(LeafNode) - (kNodeSize - (kNodeSize >> size_class)) * sizeof(std::atomic<KVPair*>);
+  }
+
+  // the size class of the fewest slots, a new tree starts with a root leaf node of it
+  static constexpr int max_class() { return kMaxClass; }
+
+  int size_class() { return control_.size_class(); }
+
+  /* the size class current node should be resized to, current node must be
+   * latched: the next larger class if full, the smallest class with at least
+   * twice as many slots as keys if at most a quarter full, otherwise its own */
+  int fit_class() {
+    int size_class = control_.size_class(), nkey = popcount(bitmap_);
+    if(size_class > 0 && nkey >= (kNodeSize >> size_class)) return size_class - 1;
+    if(size_class < kMaxClass && nkey * 4 <= (kNodeSize >> size_class)) {
+      while(size_class < kMaxClass && nkey * 2 <= (kNodeSize >> (size_class + 1)))
+        size_class += 1;
+    }
+    return size_class;
+  }
+
+  /* move all kv pairs and meta information into node, a new leaf node of another
+   * size class, both must be latched; current node is deleted like a merged node,
+   * its sibling_ points to node, so concurrent threads move to node */
+  void resize(LeafNode* node) {
+    int nkey = 0;
+    uint64_t mask = bitmap_;
+    while(mask) {
+      int idx = index_least1(mask);
+      node->tags_[nkey] = tags_[idx];
+      // using exchange, because other update operations may happen concurrently
+      KVPair* kv = kvs_[idx].exchange(nullptr); // get the latest value, and set it to null
+      node->kvs_[nkey++].store(kv, store_order);
+      mask &= ~(0x01ul << idx);
+    }
+    DEBUG_COND_ERROR(nkey > (kNodeSize >> node->size_class()), "resize error");
+    node->bitmap_ = bitmap(nkey);
+    node->high_key_ = high_key_;
+    node->sibling_ = sibling_;
+    if(control_.has_sibling()) node->control_.set_sibling();
+
+    bitmap_ = 0;
+    sibling_ = node;
+    control_.set_delete();
+    control_.update_version(); // inform lookup thread
+  }
+
   void statistic(std::map<std::string, double>& stat) {
-    stat["index size"] += sizeof(LeafNode);
+    stat["index size"] += node_size(control_.size_class());
     if(control_.has_sibling()) {
       stat["index size"] += high_key_->len + sizeof(String);
       stat["anchor size"] += high_key_->len + sizeof(String);
@@ -653,6 +1246,10 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
   }
 
   bool to_sibling(String& key, void*& next, Control* parent, uint64_t pver) {
+    return to_sibling(std::string_view(key.str, key.len), next, parent, pver);
+  }
+
+  bool to_sibling(std::string_view key, void*& next, Control* parent, uint64_t pver) {
     if(branch_unlikely(control_.deleted())) { // current node has been deleted
       next = sibling_;
       DEBUG_COND_ERROR(next == nullptr, "to_sibling error: next == nullptr");
@@ -669,7 +1266,7 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
        * the thread need to jump to the node's sibling, but the thread didn't get the upper
        * level pointer, so just use the left-most node as it's upper level node, set version
        * to zero when init */
-      if(control_.has_sibling() && *high_key_ < key) {
+      if(control_.has_sibling() && key_compare(high_key_->str, high_key_->len, key.data(), key.size()) < 0) {
         // current node is not the rightmost node and key is greater than high_key, move to sibling
         next = sibling_;
         DEBUG_COND_ERROR(next == nullptr, "to_sibling error: next == nullptr");
@@ -682,15 +1279,15 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
   }
 
   // lookup can be executed concurrently with lookup, update, upsert, remove, sort
-  KVPair* lookup(String& key) {
-    char tag = hash(key.str, key.len); // finger print generation
+  KVPair* lookup(std::string_view key) {
+    char tag = key_tag(key.data(), key.size()); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
 
     while(mask) { // check whether the key exists or not
       int idx = index_least1(mask);
       KVPair* kv = kvs_[idx].load(load_order);
       // some other threads may be splitting or removing or sorting
-      if(kv != nullptr && key == kv->key) { return kv; }
+      if(kv != nullptr && key_equal(key.data(), key.size(), kv->key.str, kv->key.len)) { return kv; }
       mask &= ~(0x01ul << idx);
     }
 
@@ -699,14 +1296,14 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
 
   // update can be executed concurrently with update, lookup, upsert, remove, sort
   KVPair* update(KVPair* kv) {
-    char tag = hash(kv->key.str, kv->key.len); // finger print generation
+    char tag = key_tag(kv->key.str, kv->key.len); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
 
     while(mask) {
       int idx = index_least1(mask);
       int spin = 0, limit = Config::kSpinInit;
       KVPair* old = kvs_[idx].load(load_order);
-      while(old != nullptr && kv->key == old->key) {
+      while(old != nullptr && key_equal(kv->key.str, kv->key.len, old->key.str, old->key.len)) {
         if(kvs_[idx].compare_exchange_strong(old, kv)) {
           return old; // update operation succeeded
         }
@@ -734,7 +1331,7 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
     /* if the key has already existed, update it and return the old kv pointer,
      * otherwise successfully insert the ky, and return a nullptr */
     rnode = nullptr; // update or normal insert
-    char tag = hash(kv->key.str, kv->key.len); // finger print generation
+    char tag = key_tag(kv->key.str, kv->key.len); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
 
     int idx;
@@ -743,24 +1340,28 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
       KVPair* old = kvs_[idx].load(load_order);
       DEBUG_COND_ERROR(old == nullptr, "unknown error");
       // old can't be nullptr, must be a valid pointer
-      if(kv->key == old->key) {
+      if(key_equal(kv->key.str, kv->key.len, old->key.str, old->key.len)) {
         // using exchange, because other update operations may happen concurrently
         return kvs_[idx].exchange(kv); // get the latest value, and set it to kv
       }
       mask &= ~(0x01ul << idx);
     }
 
-    control_.update_version();  // it has been confirmed that we need to insert the key
-    // into current node even split the node, update node's version, don't need to update
-    // the right node's version, because other threads can't access the right node now
+    LeafNode* node = this;
+    int last = control_.last_insert(); // the split hint, before it is overwritten
+    idx = index_least0(bitmap_); // find an empty slot
+    // it has been confirmed that we need to insert the key into current node even split the
+    // node, update node's version (and record the slot of the latest insert), don't need to
+    // update the right node's version, because other threads can't access the right node now
+    control_.update_version(idx == full_idx() ? -1 : idx);
 
     // if kv pairs were originally ordered, to insert a new kv (whether
     // to split or not) will result in unordered kv pairs, in most cases
     // and the new sibling will be initialized with unordered flag
     if(control_.ordered()) control_.clear_order();
 
-    LeafNode* node = this;
-    idx = index_least0(bitmap_); // find an empty slot
+    // only the root leaf node may be of a small size class, resized before it is full
+    DEBUG_COND_ERROR(idx != full_idx() && idx >= (kNodeSize >> control_.size_class()), "small leaf node overflow");
     //if idx != full_idx, the node has an empty slot
     if(idx == full_idx()) { // full, need split
       // phase 1, keys sorting
@@ -773,7 +1374,7 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
 
       auto less = [](std::pair<String*, int>& k1,
                      std::pair<String*, int>& k2) {
-        return *k1.first < *k2.first;
+        return key_less(*k1.first, *k2.first);
       };
       std::sort(keys.begin(), keys.end(), less);
 
@@ -782,7 +1383,7 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
       new(rnode) LeafNode();
       control_.begin_splitting();
 
-      if(!control_.has_sibling() && *keys.back().first < kv->key) {
+      if(!control_.has_sibling() && key_less(*keys.back().first, kv->key)) {
         /* the rightmost node without sibling and key is greater than
          * all keys especially effective for sequential insertion */
         idx = 0, node = (LeafNode*) rnode;
@@ -793,9 +1394,15 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
         high_key_ = String::make_string(high.str, high.len);
         control_.set_sibling();
       } else {
-        // normal split, move half key-value pairs to the new node
+        // normal split, move half (or less/more, if skewed) key-value pairs to the new node
+        auto lower = [&](std::pair<String*, int>& k1) { return key_less(*k1.first, kv->key); };
+        int pos = std::partition_point(keys.begin(), keys.end(), lower) - keys.begin();
+        // the key lands right after/before the latest inserted key
+        bool clustered = last >= 0 && ((pos > 0 && keys[pos - 1].second == last) ||
+                                       (pos < kNodeSize && keys[pos].second == last));
+        int half = split_point(pos, kNodeSize, clustered);
         mask = 0x00ul;  // clear mask, mark keys moved to right node
-        int i = kNodeSize / 2, rid = 0, lid;
+        int i = half, rid = 0, lid;
         for(; i < kNodeSize; i++, rid++) {
           lid = keys[i].second;
           mask |= (0x01ul << lid);
@@ -808,25 +1415,26 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
         }
 
         /* set corresponding variables before setting flag */
-        ((LeafNode*) rnode)->bitmap_ = half_fill();
+        ((LeafNode*) rnode)->bitmap_ = bitmap(kNodeSize - half);
         ((LeafNode*) rnode)->sibling_ = sibling_;
         ((LeafNode*) rnode)->high_key_ = high_key_;
 
-        DEBUG_COND_ERROR(popcount(mask) != kNodeSize / 2, "split error");
+        DEBUG_COND_ERROR(popcount(mask) != kNodeSize - half, "split error");
         bitmap_ &= ~mask;  // remove keys in leaf node
-        DEBUG_COND_ERROR(popcount(bitmap_) != kNodeSize / 2, "split error");
+        DEBUG_COND_ERROR(popcount(bitmap_) != half, "split error");
         sibling_ = (LeafNode*) rnode;
-        String& high = *keys[kNodeSize / 2 - 1].first;
+        String& high = *keys[half - 1].first;
         high_key_ = String::make_string(high.str, high.len);
 
         if(!control_.has_sibling()) control_.set_sibling();
         else ((LeafNode*) rnode)->control_.set_sibling();
 
-        if(*high_key_ < kv->key) {
-          idx = kNodeSize / 2;
+        if(key_less(*high_key_, kv->key)) {
+          idx = kNodeSize - half;
           node = (LeafNode*) rnode;
         } else { idx = lid; }  // less than high key, select an empty slot in left node
       }
+      node->control_.set_last_insert(idx); // the slot the key lands in after splitting
 
       mid = high_key_;
     }
@@ -841,21 +1449,23 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
   }
 
   // remove can be executed concurrently with lookup, update
-  KVPair* remove(String& key, void*& mnode, String*& mid) {  // mnode: merged node
+  // lazy: leave merge to the maintenance thread (merge_sibling)
+  KVPair* remove(std::string_view key, void*& mnode, String*& mid, bool lazy) {  // mnode: merged node
     mnode = nullptr; // normal remove without merge operation
-    char tag = hash(key.str, key.len); // finger print generation
+    char tag = key_tag(key.data(), key.size()); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
 
     while(mask) { // check whether the key exists or not
       int idx = index_least1(mask);
       KVPair* kv = kvs_[idx].load(load_order);
       // kv can't be nullptr, must be a valid pointer
-      if(kv->key == key) {
-        control_.update_version(); // key exists, update node version
+      if(key_equal(key.data(), key.size(), kv->key.str, kv->key.len)) {
+        int last = control_.last_insert();
+        control_.update_version(last == idx ? -1 : last); // key exists, update node version
         bitmap_ &= ~(0x01ul << idx); // update bitmap
         // using exchange, because other update operations may happen concurrently
         kv = kvs_[idx].exchange(nullptr); // get the latest value, and set it to null
-        merge(mnode, mid);  // try to merge with sibling
+        if(!lazy) merge(mnode, mid, kMergeSize);  // try to merge with sibling
 
         // normal remove kv from a node never change the order, only if to merge current node
         // with its sibling, the order may change; however normal remove results in kv pairs
@@ -870,6 +1480,26 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
     return nullptr; // key does not exist
   }
 
+  // current node and its sibling may be merged, a hint without latch
+  bool underfull(int merge_size = kMergeSize) {
+    if(!control_.has_sibling() || control_.deleted()) return false;
+    int lnkey = popcount(bitmap_), rnkey = popcount(sibling_->bitmap_);
+    return lnkey + rnkey <= merge_size || lnkey == 0;
+  }
+
+  // the high key may be retired by merge, access it in the epoch guard
+  String* high_key() { return high_key_; }
+
+  // merge with the right sibling node if underfull, current node must be latched
+  void merge_sibling(void*& mnode, String*& mid, int merge_size) {
+    mnode = nullptr;
+    merge(mnode, mid, merge_size);
+    if(mnode != nullptr) {
+      control_.update_version(); // kvs of the sibling are moved in
+      if(control_.ordered()) control_.clear_order();
+    }
+  }
+
   // sort kv pairs, current node need to be latched like remove/upsert,executed concurrently with lookup, update
   // lookup/update never change the order of kv pairs in current node, so the ordered flag never changed
   // upsert/remove may change the order of kv pairs in current node, note modification of the ordered flag
@@ -890,38 +1520,44 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
 
       auto less = [](std::pair<KVPair*, int>& a,
                      std::pair<KVPair*, int>& b) {
-        return a.first->key < b.first->key;
+        return key_less(a.first->key, b.first->key);
       };
       std::sort(keys.begin(), keys.end(), less);
 
+      int last = control_.last_insert(), sorted_last = -1; // the latest insert moves too
       for(int idx = 0; idx < keys.size(); idx++) {
         auto [kv, pos] = keys[idx];
         tags[idx] = tags_[pos];
         kvs_[idx].store(kv, store_order);
+        if(pos == last) sorted_last = idx;
       }
       memcpy(tags_, tags, kNodeSize);
       bitmap_ = bitmap(keys.size());
 
       control_.set_order();
-      control_.update_version();
+      control_.update_version(sorted_last);
     }
   }
 
   std::pair<KVPair*, int> bound(String& key, bool upper) {
+    return bound(std::string_view(key.str, key.len), upper);
+  }
+
+  std::pair<KVPair*, int> bound(std::string_view key, bool upper) {
     // true for upper_bound, false for lower_bound
     // first try to search the key in current node
     int nkey = popcount(bitmap_);
-    char tag = hash(key.str, key.len); // finger print generation
+    char tag = key_tag(key.data(), key.size()); // finger print generation
     uint64_t mask = bitmap_ & compare_equal(tags_, tag); // candidates
 
     while(mask) { // check whether the key exists or not
       int idx = index_least1(mask);
       KVPair* kv = kvs_[idx].load(load_order);
       // some other threads may be splitting or removing or sorting
-      if(kv != nullptr && key == kv->key) {
+      if(kv != nullptr && key_equal(key.data(), key.size(), kv->key.str, kv->key.len)) {
         // find the key in current node
         if(upper) {
-          if(idx + 1 >= nkey) std::make_pair(nullptr, 0);
+          if(idx + 1 >= nkey) return std::make_pair(nullptr, 0);
           kv = kvs_[idx + 1].load(load_order);
           return std::make_pair(kv, idx + 1);
         }
@@ -941,8 +1577,10 @@ class alignas(Config::kAlignSize) LeafNode<String, V> {
     }
 
     // upper_bound is equivalent to lower_bound
-    auto less = [](String* k1, String* k2) { return *k1 < *k2; };
-    auto it = std::upper_bound(keys.begin(), keys.end(), &key, less);
+    auto less = [](std::string_view k1, String* k2) {
+      return key_compare(k1.data(), k1.size(), k2->str, k2->len) < 0;
+    };
+    auto it = std::upper_bound(keys.begin(), keys.end(), key, less);
     int kid = it - keys.begin(); // the ordinal of bound kv in ordered view
     // key is greater than all keys in current node or current node is empty
     if(kid >= nkey) return std::make_pair(nullptr, 0);
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022-Present, Chen Yuan <yuan.chen@whu.edu.cn>
+ *
+ * All rights reserved. No warranty, explicit or implicit, provided.
+ */
+
+#ifndef INDEXRESEARCH_MODEL_H
+#define INDEXRESEARCH_MODEL_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include "config.h"
+
+namespace FeatureBTree {
+
+/* learned root model (Config::kRootModel, integer keys only), an error-bounded
+ * piecewise linear model, like the PGM-index, over the lower bounds of the inner
+ * nodes kModelLevels levels below the root; it predicts the inner node to start
+ * traversal, skipping the top levels; a live inner node never gets a greater lower
+ * bound (a split moves its upper part right, a merge or border remove only extends
+ * it left), so a node whose recorded lower bound is less than the key is a valid
+ * start point of to_next, which moves right to siblings; the model is immutable,
+ * rebuilt and replaced as a whole, and retired by epoch */
+template<typename K>
+class RootModel {
+  static constexpr int kError = Config::kModelError;
+
+  struct Segment {
+    uint64_t start_; // ordinal of the first key
+    int pos_;        // position of the first key
+    double slope_;
+  };
+
+  uint64_t gen_;      // inner node deletions of the tree when built
+  uint64_t splits_;   // inner node splits of the tree when built
+  int nnode_;         // nodes[0] covers all keys less than bounds[1]
+  int nseg_;
+  uint64_t* bounds_;  // ordinals of the exclusive lower bounds of nodes
+  void** nodes_;
+  Segment* segs_;
+
+  // order-preserving mapping of keys to unsigned integers
+  static uint64_t ordinal(K key) {
+    static_assert(std::is_integral_v<K> && sizeof(K) <= sizeof(uint64_t));
+    if constexpr(std::is_signed_v<K>) return (uint64_t) (int64_t) key ^ (0x01ul << 63);
+    else return (uint64_t) key;
+  }
+
+  RootModel() = default;
+
+  // shrinking cone, positions of all bounds are predicted within kError
+  void train() {
+    int start = 1;
+    nseg_ = 0;
+    while(start < nnode_) {
+      double lo = 0, hi = std::numeric_limits<double>::infinity();
+      int end = start + 1;
+      for(; end < nnode_; end++) {
+        double dx = bounds_[end] - bounds_[start], dy = end - start;
+        double nlo = std::max(lo, (dy - kError) / dx);
+        double nhi = std::min(hi, (dy + kError) / dx);
+        if(nlo > nhi) break;
+        lo = nlo, hi = nhi;
+      }
+      double slope = end == start + 1 ? 0 : (lo + hi) / 2;
+      segs_[nseg_++] = Segment{bounds_[start], start, slope};
+      start = end;
+    }
+  }
+
+ public:
+  /* nodes are the inner nodes of one level from left to right with the exclusive
+   * lower bounds of their key ranges, nodes[0].first is ignored */
+  static RootModel* build(std::vector<std::pair<K, void*>>& nodes, uint64_t gen, uint64_t splits) {
+    int nnode = nodes.size();
+    size_t size = sizeof(RootModel) + nnode * (sizeof(uint64_t) + sizeof(void*) + sizeof(Segment));
+    RootModel* model = (RootModel*) malloc(size);
+    new(model) RootModel();
+    model->gen_ = gen, model->splits_ = splits;
+    model->bounds_ = (uint64_t*) (model + 1);
+    model->nodes_ = (void**) (model->bounds_ + nnode);
+    model->segs_ = (Segment*) (model->nodes_ + nnode);
+    model->bounds_[0] = 0, model->nodes_[0] = nodes[0].second, nnode = 1;
+    for(int i = 1; i < nodes.size(); i++) {
+      /* nodes are read at different times, skip a node whose bound is not
+       * increasing, keys of it start from its left node and move right */
+      uint64_t bound = ordinal(nodes[i].first);
+      if(nnode > 1 && bound <= model->bounds_[nnode - 1]) continue;
+      model->bounds_[nnode] = bound, model->nodes_[nnode] = nodes[i].second;
+      nnode += 1;
+    }
+    model->nnode_ = nnode;
+    model->train();
+    return model;
+  }
+
+  uint64_t gen() { return gen_; }
+
+  uint64_t splits() { return splits_; }
+
+  int size() { return nnode_; }
+
+  // the last node whose lower bound is less than key
+  void* find(K key) {
+    uint64_t x = ordinal(key);
+    if(nnode_ == 1 || x <= bounds_[1]) return nodes_[0];
+
+    auto seg = std::upper_bound(segs_, segs_ + nseg_, x, [](uint64_t x, const Segment& s) {
+      return x < s.start_;
+    }) - 1; // x > bounds[1] == segs[0].start
+    double pred = seg->pos_ + seg->slope_ * (double) (x - seg->start_);
+    int pos = pred < nnode_ ? (int) pred : nnode_;
+    int lo = std::max(1, pos - kError - 1), hi = std::min(nnode_, pos + kError + 2);
+    // bounds are predicted within kError, so keys between bounds rarely miss the window
+    if(lo >= hi || bounds_[lo] >= x || (hi < nnode_ && bounds_[hi] < x)) lo = 1, hi = nnode_;
+    // the first bound not less than x in [lo, hi)
+    int idx = std::lower_bound(bounds_ + lo, bounds_ + hi, x) - bounds_;
+    return nodes_[idx - 1];
+  }
+};
+
+}
+
+#endif //INDEXRESEARCH_MODEL_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2022-Present, Chen Yuan <yuan.chen@whu.edu.cn>
+ *
+ * All rights reserved. No warranty, explicit or implicit, provided.
+ */
+
+#ifndef INDEXRESEARCH_MVCC_H
+#define INDEXRESEARCH_MVCC_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include "config.h"
+
+namespace FeatureBTree {
+
+/* the kv of a key before a write (Config::kMvccOpt), kept in the undo list of
+ * the leaf node holding the key while some snapshot is older than the write;
+ * kv_ is a private copy (null if the key was absent), so it never depends on
+ * when the caller retires the old kv */
+template<typename K, typename V>
+struct Undo {
+  typedef util::KVPair<K, V> KVPair;
+
+  uint64_t ts_;  // timestamp of the write
+  Undo* next_;   // earlier writes to the leaf node
+  K key_;
+  KVPair* kv_;   // the kv before the write, null if absent
+
+  Undo(uint64_t ts, const K& key, KVPair* old) : ts_(ts), next_(nullptr), key_(key), kv_(nullptr) {
+    if(old != nullptr) {
+      kv_ = (KVPair*) malloc(sizeof(KVPair));
+      new(kv_) KVPair{old->key, old->value};
+    }
+  }
+
+  ~Undo() {
+    if(kv_ != nullptr) {
+      kv_->~KVPair();
+      free(kv_);
+    }
+  }
+};
+
+/* timestamps of writes and snapshots: every write is stamped under the latch of
+ * its leaf node after it is applied, a snapshot of timestamp ts sees writes
+ * stamped at or before ts; undo entries of writes at or before floor() are not
+ * needed by any live or future snapshot */
+class VersionClock {
+  std::atomic<uint64_t> clock_;
+  std::atomic<int> active_;       // live (or being taken) snapshots
+  std::atomic<uint64_t> oldest_;  // the oldest live snapshot
+  std::mutex mutex_;
+  std::multiset<uint64_t> snapshots_;
+
+ public:
+  VersionClock() : clock_(0), active_(0), oldest_(UINT64_MAX) {}
+
+  // stamp a write, its leaf node must be latched
+  uint64_t tick() { return clock_.fetch_add(1) + 1; }
+
+  /* read after tick: no snapshot seen means any snapshot taken later is not
+   * older than the write, so nothing needs to be kept */
+  uint64_t floor() { return active_.load() == 0 ? UINT64_MAX : oldest_.load(); }
+
+  uint64_t acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    oldest_.store(0); // keep all until the snapshot is registered
+    active_.fetch_add(1);
+    uint64_t ts = clock_.load();
+    snapshots_.insert(ts);
+    oldest_.store(*snapshots_.begin());
+    return ts;
+  }
+
+  void release(uint64_t ts) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshots_.erase(snapshots_.find(ts));
+    oldest_.store(snapshots_.empty() ? UINT64_MAX : *snapshots_.begin());
+    active_.fetch_sub(1);
+  }
+};
+
+}
+
+#endif //INDEXRESEARCH_MVCC_H
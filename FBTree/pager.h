@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2022-Present, Chen Yuan <yuan.chen@whu.edu.cn>
+ *
+ * All rights reserved. No warranty, explicit or implicit, provided.
+ */
+
+#ifndef INDEXRESEARCH_PAGER_H
+#define INDEXRESEARCH_PAGER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include "constant.h"
+#include "checkpoint.h"
+
+namespace FeatureBTree {
+
+/* fixed-size pages of a scratch file holding the kv pairs of cold leaf nodes
+ * (Config::kPagingOpt, basic type keys and trivially copyable values), a page
+ * holds the checksum and the records (key bytes, value bytes) of the used slots
+ * of a leaf node in slot order; freed pages are reused, the file is unlinked
+ * once opened, it is not a snapshot (see FBTree::save) */
+template<typename K, typename V>
+class Pager {
+  static constexpr size_t kRecord = sizeof(K) + sizeof(V);
+
+  int fd_;
+  std::mutex mutex_;
+  std::vector<uint64_t> free_; // freed pages
+  uint64_t next_;              // pages ever allocated
+
+  explicit Pager(int fd) : fd_(fd), next_(0) {}
+
+  [[noreturn]] static void fatal(const char* msg) {
+    fprintf(stderr, "%s\n", msg);
+    std::abort();
+  }
+
+ public:
+  static constexpr size_t kPageSize = (sizeof(uint64_t) + Constant<K>::kLeafSize * kRecord + 511) / 512 * 512;
+
+  ~Pager() { close(fd_); }
+
+  // create (or truncate) the file at path and unlink it, null on error
+  static Pager* open(const char* path) {
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return nullptr;
+    unlink(path); // a scratch file, reclaimed once closed
+    return new Pager(fd);
+  }
+
+  // write data (at most kPageSize - 8 bytes) to a free page and get its id, false on error
+  bool write(const char* data, size_t size, uint64_t& page) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(!free_.empty()) page = free_.back(), free_.pop_back();
+      else page = next_++;
+    }
+    char buffer[kPageSize];
+    uint64_t sum = checksum(data, size);
+    memcpy(buffer, &sum, sizeof(uint64_t));
+    memcpy(buffer + sizeof(uint64_t), data, size);
+    if(pwrite(fd_, buffer, kPageSize, page * kPageSize) != (ssize_t) kPageSize) {
+      release(page);
+      return false;
+    }
+    return true;
+  }
+
+  // read size bytes of the page into data, and free the page, abort on error
+  // (the kv pairs only live in the page, there is nothing to fall back on)
+  void read(uint64_t page, char* data, size_t size) {
+    char buffer[kPageSize];
+    if(pread(fd_, buffer, kPageSize, page * kPageSize) != (ssize_t) kPageSize)
+      fatal("fatal error, failed to read a page!");
+    uint64_t sum;
+    memcpy(&sum, buffer, sizeof(uint64_t));
+    memcpy(data, buffer + sizeof(uint64_t), size);
+    if(sum != checksum(data, size)) fatal("fatal error, corrupted page!");
+    release(page);
+  }
+
+  void release(uint64_t page) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(page);
+  }
+
+  // the number of pages in use
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_ - free_.size();
+  }
+};
+
+// the page holding kv pairs of a leaf node, see LeafNode::page_out
+template<typename K, typename V>
+struct PageRef {
+  Pager<K, V>* pager_;
+  uint64_t page_;
+};
+
+}
+
+#endif //INDEXRESEARCH_PAGER_H
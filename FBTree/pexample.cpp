@@ -0,0 +1,231 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fbtree.h"
+
+using namespace FeatureBTree;
+
+typedef FBTree<uint64_t, uint64_t> Tree;
+
+void check(bool cond, const char* what) {
+  if(!cond) {
+    std::cout << "check error: " << what << std::endl;
+    exit(-1);
+  }
+}
+
+// the number of kv pairs in scan, which must be key + 1 for each key in [low, high)
+size_t scan_check(Tree& tree, uint64_t low, uint64_t high) {
+  EpochGuard epoch_guard(tree.get_epoch());
+  size_t n = 0;
+  for(auto it = tree.begin(); !it.end(); it.advance(), n++)
+    check(it->key == low + n && it->key < high && it->value == it->key + 1, "scan is out of order");
+  return n;
+}
+
+// does the tree hold exactly the kv pairs of expect, in key order
+bool same(Tree& tree, const std::map<uint64_t, uint64_t>& expect) {
+  EpochGuard epoch_guard(tree.get_epoch());
+  auto kv = expect.begin();
+  for(auto it = tree.begin(); !it.end(); it.advance(), ++kv)
+    if(kv == expect.end() || it->key != kv->first || it->value != kv->second) return false;
+  return kv == expect.end();
+}
+
+// flip one byte of a file at offset
+void corrupt(const std::string& path, off_t offset) {
+  FILE* file = fopen(path.c_str(), "r+b");
+  check(file != nullptr && fseek(file, offset, SEEK_SET) == 0, "corrupted file can't be opened");
+  int c = fgetc(file);
+  fseek(file, offset, SEEK_SET);
+  fputc(c ^ 0xFF, file);
+  fclose(file);
+}
+
+// remove the file at path and the numbered files <path>.<seq>
+void remove_files(const std::string& path) {
+  for(uint64_t seq : numbered_files(path)) unlink(numbered_file(path, seq).c_str());
+  unlink(path.c_str());
+}
+
+// with maintenance on, removals leave the leftmost leaf nodes empty until the next pass
+void empty_leftmost_test(size_t nkey, const std::string& dir) {
+  std::string path = dir + "/fbtree_pexample_empty.snap";
+  size_t nremove = nkey / 2;
+  Tree tree;
+  std::cout << "-- empty leftmost leaf ... " << std::flush;
+  for(uint64_t i = 0; i < nkey; i++) {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.upsert(i, i + 1) == nullptr, "duplicate key");
+  }
+  tree.start_maintenance(std::chrono::hours(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100)); // the first pass is over
+  for(uint64_t i = 0; i < nremove; i++) {
+    EpochGuard epoch_guard(tree.get_epoch());
+    auto old = tree.remove(i);
+    check(old != nullptr, "removed key not found");
+    epoch_guard.retire(old);
+  }
+  check(scan_check(tree, nremove, nkey) == nkey - nremove, "scan misses keys behind empty leaf nodes");
+  {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.save(path.c_str()), "save failed");
+  }
+  tree.stop_maintenance();
+
+  Tree loaded;
+  check(loaded.load(path.c_str()), "load failed");
+  check(scan_check(loaded, nremove, nkey) == nkey - nremove, "snapshot misses keys behind empty leaf nodes");
+  unlink(path.c_str());
+  std::cout << "end" << std::endl;
+}
+
+// save and load by several threads keep every kv pair, a corrupted block fails the load
+void snapshot_test(size_t nkey, const std::string& dir) {
+  std::string path = dir + "/fbtree_pexample.snap";
+  std::mt19937_64 rng(nkey);
+  std::map<uint64_t, uint64_t> expect;
+  Tree tree;
+  std::cout << "-- snapshot round trip ... " << std::flush;
+  for(size_t i = 0; i < nkey; i++) {
+    uint64_t key = rng(), value = rng();
+    EpochGuard epoch_guard(tree.get_epoch());
+    auto old = tree.upsert(key, value);
+    if(old != nullptr) epoch_guard.retire(old);
+    expect[key] = value;
+  }
+  {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.save(path.c_str(), 4), "save failed");
+  }
+  Tree loaded;
+  check(loaded.load(path.c_str(), 4), "load failed");
+  check(same(loaded, expect), "loaded tree differs from the saved one");
+  std::cout << "end" << std::endl;
+
+  std::cout << "-- corrupted snapshot ... " << std::flush;
+  corrupt(path, sizeof(SnapshotHeader) + 8); // a byte of the first block
+  Tree broken;
+  check(!broken.load(path.c_str(), 4), "corrupted snapshot is loaded");
+  check(!broken.load((path + ".missing").c_str()), "missing snapshot is loaded");
+  Tree empty, reloaded;
+  {
+    EpochGuard epoch_guard(empty.get_epoch());
+    check(empty.save(path.c_str()), "save of an empty tree failed");
+  }
+  check(reloaded.load(path.c_str()) && same(reloaded, {}), "empty snapshot round trip");
+  unlink(path.c_str());
+  std::cout << "end" << std::endl;
+}
+
+// a torn record at the end of the log is dropped at recovery, and later records go to a new segment
+void log_test(size_t nkey, const std::string& dir) {
+  std::string path = dir + "/fbtree_pexample.log";
+  size_t nremove = nkey / 4;
+  remove_files(path);
+  std::cout << "-- log replay ... " << std::flush;
+  {
+    Tree tree;
+    check(tree.open_log(path.c_str()), "open log failed");
+    for(uint64_t i = 0; i < nkey; i++) {
+      EpochGuard epoch_guard(tree.get_epoch());
+      check(tree.upsert(i, i + 1) == nullptr, "duplicate key");
+    }
+    for(uint64_t i = 0; i < nremove; i++) {
+      EpochGuard epoch_guard(tree.get_epoch());
+      auto old = tree.remove(i);
+      check(old != nullptr, "removed key not found");
+      epoch_guard.retire(old);
+    }
+    check(!tree.log_failed(), "log write failed");
+  } // a crash after the records are durable
+
+  // tear the last record, the removal of key nremove - 1, each record is synced in its own group
+  std::vector<uint64_t> segments = numbered_files(path);
+  check(segments.size() == 1, "log segments");
+  std::string segment = numbered_file(path, segments.back());
+  struct stat st;
+  check(stat(segment.c_str(), &st) == 0 && truncate(segment.c_str(), st.st_size - 3) == 0, "log can't be torn");
+  {
+    Tree tree;
+    check(tree.open_log(path.c_str()), "recovery failed");
+    check(scan_check(tree, nremove - 1, nkey) == nkey - nremove + 1, "recovered tree differs from the log");
+    EpochGuard epoch_guard(tree.get_epoch());
+    auto old = tree.remove(nremove - 1);
+    check(old != nullptr, "recovered key not found");
+    epoch_guard.retire(old);
+  }
+  {
+    Tree tree;
+    check(tree.open_log(path.c_str()), "recovery after a torn segment failed");
+    check(scan_check(tree, nremove, nkey) == nkey - nremove, "records after a torn segment are lost");
+  }
+  remove_files(path);
+  std::cout << "end" << std::endl;
+}
+
+/* incremental checkpoints write the modified key ranges as deltas over the snapshot,
+ * recovery applies them before the log, and folding them keeps the same state */
+void checkpoint_test(size_t nkey, const std::string& dir) {
+  std::string path = dir + "/fbtree_pexample_ckpt.log", snapshot = dir + "/fbtree_pexample_ckpt.snap";
+  std::mt19937_64 rng(nkey);
+  std::map<uint64_t, uint64_t> expect;
+  remove_files(path), remove_files(snapshot);
+  std::cout << "-- incremental checkpoint ... " << std::flush;
+  {
+    Tree tree;
+    check(tree.open_log(path.c_str(), snapshot.c_str()), "open log failed");
+    auto modify = [&](size_t n) { // upserts and removals of random keys in [0, 2 * nkey)
+      for(size_t i = 0; i < n; i++) {
+        uint64_t key = rng() % (2 * nkey), value = rng();
+        EpochGuard epoch_guard(tree.get_epoch());
+        auto old = i % 4 == 3 ? tree.remove(key) : tree.upsert(key, value);
+        if(old != nullptr) epoch_guard.retire(old);
+        if(i % 4 == 3) expect.erase(key);
+        else expect[key] = value;
+      }
+    };
+    modify(nkey);
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.checkpoint(snapshot.c_str()), "checkpoint failed");
+    for(int round = 0; round < 3; round++) {
+      modify(nkey / 8);
+      check(tree.checkpoint_incremental(snapshot.c_str()), "incremental checkpoint failed");
+    }
+    modify(nkey / 8); // only in the log
+  }
+  check(numbered_files(snapshot).size() == 3, "delta files");
+  {
+    Tree tree;
+    check(tree.open_log(path.c_str(), snapshot.c_str()), "recovery from deltas failed");
+    check(same(tree, expect), "tree recovered from deltas differs");
+    check(tree.compact_checkpoint(snapshot.c_str()), "folding deltas failed");
+  }
+  check(numbered_files(snapshot).empty(), "folded delta files are kept");
+  {
+    Tree tree;
+    check(tree.open_log(path.c_str(), snapshot.c_str()), "recovery from the folded snapshot failed");
+    check(same(tree, expect), "tree recovered from the folded snapshot differs");
+  }
+  remove_files(path), remove_files(snapshot);
+  std::cout << "end" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  if(argc < 2) {
+    std::cout << "-- nkey [dir]" << std::endl;
+    exit(-1);
+  }
+  size_t nkey = std::stoul(argv[1]);
+  std::string dir = argc > 2 ? argv[2] : "/tmp";
+
+  std::cout << "-- persistence test: " << nkey << std::endl;
+  snapshot_test(nkey, dir);
+  log_test(std::min<size_t>(nkey, 1000), dir); // each record is synced
+  checkpoint_test(std::min<size_t>(nkey, 1000), dir);
+  empty_leftmost_test(nkey, dir);
+  return 0;
+}
@@ -0,0 +1,212 @@
+#include <iostream>
+#include <random>
+#include <thread>
+#include "fbtree.h"
+
+using namespace FeatureBTree;
+
+typedef FBTree<uint64_t, int64_t> Tree;
+
+// accounts are keys 0, kGap, 2 * kGap, ..., transactions also write groups of keys between them
+constexpr uint64_t kGap = 1000;
+constexpr int64_t kBalance = 1000;
+
+void check(bool cond, const char* what) {
+  if(!cond) {
+    std::cout << "check error: " << what << std::endl;
+    exit(-1);
+  }
+}
+
+void retire(Tree& tree, KVPair<uint64_t, int64_t>* old) {
+  if(old != nullptr) tree.get_epoch().retire(old);
+}
+
+// the balances of naccount accounts, read by a transaction, false if it failed to commit
+bool balance(Tree& tree, size_t naccount, int64_t& sum) {
+  EpochGuard epoch_guard(tree.get_epoch());
+  Tree::Transaction tx(tree);
+  sum = 0;
+  for(uint64_t i = 0; i < naccount; i++) {
+    int64_t value;
+    if(tx.read(i * kGap, value)) sum += value;
+  }
+  return tx.commit();
+}
+
+// reads see own writes, and abort or a failed commit writes nothing
+void transaction_basic_test() {
+  Tree tree;
+  std::cout << "-- transaction basics ... " << std::flush;
+  EpochGuard epoch_guard(tree.get_epoch());
+  check(tree.upsert((uint64_t) 1, (int64_t) 1) == nullptr, "duplicate key");
+  Tree::Transaction tx(tree);
+  int64_t value;
+  tx.write((uint64_t) 2, (int64_t) 2);
+  tx.remove(1);
+  check(tx.read(2, value) && value == 2, "transaction doesn't read its own write");
+  check(!tx.read(1, value), "transaction reads its own removed key");
+  tx.abort();
+  check(tree.lookup(2) == nullptr && tree.lookup(1) != nullptr, "aborted transaction is written");
+
+  check(tx.read(1, value) && value == 1, "read after abort");
+  tx.write((uint64_t) 1, value + 1);
+  retire(tree, tree.upsert((uint64_t) 1, (int64_t) 10)); // the read is stale now
+  check(!tx.commit(), "transaction with a stale read commits");
+  check(tree.lookup(1)->value == 10, "failed commit is written");
+
+  check(tx.read(1, value) && value == 10, "read after a failed commit");
+  tx.write((uint64_t) 1, value + 1);
+  tx.write((uint64_t) 3, (int64_t) 3);
+  check(tx.commit(), "transaction fails to commit");
+  check(tree.lookup(1)->value == 11 && tree.lookup(3) != nullptr, "committed writes are missing");
+  std::cout << "end" << std::endl;
+}
+
+/* nthd threads transfer between random accounts and write or remove a group of
+ * keys between them in one transaction, while read-only transactions check the
+ * total balance, and single-key upserts and removes run in between */
+void transfer_test(size_t naccount, int nthd, size_t ntx) {
+  Tree tree;
+  std::cout << "-- concurrent transfers ... " << std::flush;
+  for(uint64_t i = 0; i < naccount; i++) {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.upsert(i * kGap, kBalance) == nullptr, "duplicate account");
+  }
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> workers;
+  for(int tid = 0; tid < nthd; tid++) {
+    workers.emplace_back([&](int tid) {
+      std::mt19937_64 rng(tid);
+      for(size_t i = 0; i < ntx; i++) {
+        uint64_t from = rng() % naccount * kGap, to = rng() % naccount * kGap;
+        uint64_t group = rng() % naccount * kGap + 1 + tid * 20;
+        int64_t amount = rng() % 50;
+        bool insert = rng() % 2;
+        if(from == to) continue;
+        EpochGuard epoch_guard(tree.get_epoch());
+        Tree::Transaction tx(tree);
+        while(true) {
+          int64_t a, b;
+          check(tx.read(from, a) && tx.read(to, b), "account not found");
+          tx.write(from, a - amount);
+          tx.write(to, b + amount);
+          for(uint64_t k = group; k < group + 20; k++) {
+            if(insert) tx.write(k, (int64_t) 7);
+            else tx.remove(k);
+          }
+          if(tx.commit()) break;
+        }
+      }
+    }, tid);
+  }
+  std::thread checker([&]() {
+    while(!stop) {
+      int64_t sum;
+      if(balance(tree, naccount, sum)) check(sum == (int64_t) naccount * kBalance, "transaction reads a torn transfer");
+    }
+  });
+  std::thread churn([&]() { // keys between accounts and groups
+    std::mt19937_64 rng(nthd);
+    while(!stop) {
+      EpochGuard epoch_guard(tree.get_epoch());
+      uint64_t key = rng() % naccount * kGap + 500 + rng() % 100;
+      retire(tree, rng() % 2 ? tree.upsert(key, (int64_t) 1) : tree.remove(key));
+    }
+  });
+  for(auto& worker : workers) worker.join();
+  stop = true;
+  checker.join(), churn.join();
+
+  int64_t sum;
+  check(balance(tree, naccount, sum) && sum == (int64_t) naccount * kBalance, "transfers lost the balance");
+  EpochGuard epoch_guard(tree.get_epoch());
+  for(uint64_t i = 0; i < naccount; i++) { // each group is written or removed as a whole
+    for(int tid = 0; tid < nthd; tid++) {
+      uint64_t group = i * kGap + 1 + tid * 20;
+      bool present = tree.lookup(group) != nullptr;
+      for(uint64_t k = group + 1; k < group + 20; k++)
+        check((tree.lookup(k) != nullptr) == present, "transaction writes a torn group");
+    }
+  }
+  std::cout << "end" << std::endl;
+}
+
+/* snapshots see the tree as of their creation: a writer bumps the values of
+ * [1, nkey) in rounds from the top down, so a scan sees a non-decreasing run
+ * of values differing by at most one, and removed or upserted keys as of then */
+template<typename T>
+void snapshot_test(size_t nkey, size_t nround) {
+  T tree;
+  std::cout << "-- snapshot scans ... " << std::flush;
+  for(uint64_t i = 0; i < nkey; i++) {
+    EpochGuard epoch_guard(tree.get_epoch());
+    check(tree.upsert(i, (int64_t) 0) == nullptr, "duplicate key");
+  }
+  {
+    typename T::Snapshot snapshot(tree);
+    {
+      EpochGuard epoch_guard(tree.get_epoch());
+      retire(tree, tree.remove(0));
+      retire(tree, tree.upsert((uint64_t) 1, (int64_t) 1));
+      retire(tree, tree.upsert((uint64_t) nkey, (int64_t) 1));
+    }
+    size_t n = 0;
+    snapshot.scan(0, nkey, [&](const uint64_t& key, const int64_t& value) {
+      check(key == n++ && value == 0, "snapshot sees later writes");
+      return true;
+    });
+    check(n == nkey, "snapshot misses keys");
+  }
+
+  std::atomic<bool> stop = false;
+  std::thread writer([&]() {
+    for(size_t round = 1; round <= nround; round++) {
+      for(uint64_t key = nkey; key-- > 1;) {
+        EpochGuard epoch_guard(tree.get_epoch());
+        retire(tree, tree.upsert(key, (int64_t) round));
+      }
+    }
+    stop = true;
+  });
+  std::thread maintainer([&]() { // drops undo entries no snapshot needs
+    while(!stop) {
+      {
+        EpochGuard epoch_guard(tree.get_epoch());
+        tree.maintain();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+  });
+  while(!stop) {
+    typename T::Snapshot snapshot(tree);
+    uint64_t next = 2; // key 1 was upserted above
+    int64_t last = 0;
+    snapshot.scan(2, nkey - 1, [&](const uint64_t& key, const int64_t& value) {
+      check(key == next++, "snapshot scan is out of order");
+      check(key == 2 || (value >= last && value <= last + 1), "snapshot sees a state that never existed");
+      last = value;
+      return true;
+    });
+    check(next == nkey, "snapshot scan misses keys");
+  }
+  writer.join(), maintainer.join();
+  std::cout << "end" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  if(argc < 3) {
+    std::cout << "-- naccount nthd" << std::endl;
+    exit(-1);
+  }
+  size_t naccount = std::stoul(argv[1]);
+  int nthd = std::stoi(argv[2]);
+  check(nthd <= 24, "groups of 20 keys per thread are below the churned keys");
+
+  std::cout << "-- transaction test: " << naccount << " " << nthd << std::endl;
+  transaction_basic_test();
+  transfer_test(naccount, nthd, 2000);
+  if constexpr(Config::kMvccOpt) snapshot_test<Tree>(naccount * 10, 100);
+  else std::cout << "-- snapshot scans need Config::kMvccOpt, skipped" << std::endl;
+  return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2022-Present, Chen Yuan <yuan.chen@whu.edu.cn>
+ *
+ * All rights reserved. No warranty, explicit or implicit, provided.
+ */
+
+#ifndef INDEXRESEARCH_WAL_H
+#define INDEXRESEARCH_WAL_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "checkpoint.h"
+
+namespace FeatureBTree {
+
+enum LogOp : uint8_t { kLogUpsert = 1, kLogUpdate = 2, kLogRemove = 3 };
+
+/* redo log of upsert/update/remove (basic type keys, trivially copyable values),
+ * see FBTree::open_log; records are appended to a shared group buffer, and the
+ * first waiting writer becomes the leader, which writes the whole group with one
+ * write and one fdatasync (group commit), other writers of the group just wait;
+ * a group is framed by its size and checksum, so replay stops at a torn tail;
+ * records of the same key are appended and applied in one stripe section, which
+ * keeps the log order of a key the same as the order applied to the tree; the
+ * log is split into segments <path>.<seq>, a checkpoint switches to the next
+ * segment, and the segments before it are dropped once the snapshot is saved;
+ * a group failed to be written is reported by commit, sync and failed() until
+ * a snapshot covers it, see checkpointed */
+template<typename K, typename V>
+class RedoLog {
+  static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>);
+  static constexpr int kStripes = 256;
+  static constexpr size_t kRecord = 1 + sizeof(K) + sizeof(V);
+
+  struct GroupHeader {
+    uint64_t size_;     // bytes of records
+    uint64_t checksum_; // of records
+  };
+
+  int fd_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<char> buffer_; // records of the next group
+  std::vector<char> group_;  // records being written by the leader
+  uint64_t lsn_;             // records appended
+  uint64_t durable_;         // records written and synced
+  bool leading_;             // some writer is writing a group
+  uint64_t failed_;          // the end lsn of the last group failed to be written, 0 if none
+  uint64_t rotated_;         // lsn_ when switched to the current segment
+  std::mutex stripes_[kStripes];
+
+  explicit RedoLog(int fd) : fd_(fd), lsn_(0), durable_(0), leading_(false), failed_(0), rotated_(0) {}
+
+ public:
+  ~RedoLog() {
+    sync();
+    close(fd_);
+  }
+
+  static std::string segment(const std::string& path, uint64_t seq) { return numbered_file(path, seq); }
+
+  // sequence numbers of the existing segments of the log at path, ascending
+  static std::vector<uint64_t> segments(const std::string& path) { return numbered_files(path); }
+
+  // open the segment path for appending, null on error
+  static RedoLog* open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0) return nullptr;
+    return new RedoLog(fd);
+  }
+
+  /* apply(op, key, value) to records of the log at path in order, value is null
+   * for remove; return false if the log doesn't exist, records before a torn or
+   * corrupted group are applied */
+  template<typename F>
+  static bool replay(const std::string& path, F&& apply) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    GroupHeader header;
+    std::vector<char> group;
+    off_t remain = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    while(read(fd, &header, sizeof(GroupHeader)) == (ssize_t) sizeof(GroupHeader)) {
+      remain -= sizeof(GroupHeader);
+      if(header.size_ % kRecord != 0 || header.size_ > (uint64_t) remain) break; // a torn tail
+      remain -= header.size_;
+      group.resize(header.size_);
+      if(read(fd, group.data(), header.size_) != (ssize_t) header.size_) break;
+      if(header.checksum_ != checksum(group.data(), header.size_)) break;
+      for(size_t offset = 0; offset < header.size_; offset += kRecord) {
+        K key;
+        V value;
+        memcpy(&key, group.data() + offset + 1, sizeof(K));
+        memcpy(&value, group.data() + offset + 1 + sizeof(K), sizeof(V));
+        LogOp op = (LogOp) group[offset];
+        apply(op, key, op == kLogRemove ? nullptr : &value);
+      }
+    }
+    close(fd);
+    return true;
+  }
+
+  // serializes appending and applying records of the same key
+  std::mutex& stripe(const K& key) { return stripes_[hash(key) % kStripes]; }
+
+  // append a record, return its lsn for commit, value is null for remove
+  uint64_t append(LogOp op, const K& key, const V* value) {
+    char record[kRecord] = {};
+    record[0] = op;
+    memcpy(record + 1, &key, sizeof(K));
+    if(value != nullptr) memcpy(record + 1 + sizeof(K), value, sizeof(V));
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_.insert(buffer_.end(), record, record + kRecord);
+    return ++lsn_;
+  }
+
+  // append records (op, key, value) at once, so they are written in the same group
+  uint64_t append(const std::vector<std::tuple<LogOp, K, const V*>>& records) {
+    std::vector<char> group(records.size() * kRecord);
+    char* record = group.data();
+    for(auto& [op, key, value] : records) {
+      record[0] = op;
+      memcpy(record + 1, &key, sizeof(K));
+      if(value != nullptr) memcpy(record + 1 + sizeof(K), value, sizeof(V));
+      record += kRecord;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_.insert(buffer_.end(), group.begin(), group.end());
+    return lsn_ += records.size();
+  }
+
+  /* wait until the record of lsn is written, the first waiter writes the group;
+   * return false if some group failed to be written, see failed */
+  bool commit(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(durable_ < lsn) {
+      if(leading_) {
+        cv_.wait(lock);
+        continue;
+      }
+
+      leading_ = true;
+      std::swap(buffer_, group_);
+      uint64_t end = lsn_;
+      lock.unlock();
+      GroupHeader header{group_.size(), checksum(group_.data(), group_.size())};
+      group_.insert(group_.begin(), (char*) &header, (char*) &header + sizeof(GroupHeader));
+      bool ok = write(fd_, group_.data(), group_.size()) == (ssize_t) group_.size() && fdatasync(fd_) == 0;
+      lock.lock();
+      group_.clear();
+      durable_ = end, leading_ = false;
+      if(!ok) failed_ = end;
+      cv_.notify_all();
+    }
+    return failed_ == 0;
+  }
+
+  // some records appended since the last snapshot are not durable
+  bool failed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_ != 0;
+  }
+
+  /* the tree state as of the last rotate is saved to a snapshot, so failed groups
+   * before it are no longer needed for recovery */
+  void checkpointed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(failed_ <= rotated_) failed_ = 0;
+  }
+
+  // make all appended records durable, return false if any group failed to be written
+  bool sync() {
+    uint64_t lsn;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      lsn = lsn_;
+    }
+    return commit(lsn);
+  }
+
+  /* switch to the segment path, once all records appended so far are applied
+   * (all stripes are latched) and written, so the records of the tree state
+   * after the switch are in the new segment, see FBTree::checkpoint; it switches
+   * even if some group failed, the snapshot taken next covers those records,
+   * return false if the segment can't be created */
+  bool rotate(const std::string& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0) return false;
+    for(auto& stripe : stripes_) stripe.lock();
+    sync();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return !leading_; });
+      std::swap(fd, fd_);
+      rotated_ = lsn_;
+    }
+    for(auto& stripe : stripes_) stripe.unlock();
+    close(fd);
+    return true;
+  }
+};
+
+}
+
+#endif //INDEXRESEARCH_WAL_H